@@ -21,40 +21,410 @@
  * Best Aggregate Statistics: 80% (utilization) 106% (throughput) 
  */
 
+#define _GNU_SOURCE     // for mremap
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
 #include "allocator.h"
 #include "segment.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #include "limits.h"
 
-// Heap blocks are required to be aligned to 8-byte boundary
+// Block geometry follows the native word: the IA32 build uses 4-byte
+// headers, footers and links with 8-byte alignment, while the x86-64 build
+// widens all of them to 8 bytes with 16-byte alignment. Either way a block
+// is ALIGNMENT * n - HDR_SIZE bytes so that the next payload stays aligned.
+// An x86-64 build with -DCOMPACT_LINKS=1 keeps free-list links as 32-bit 
+// offsets, in ALIGNMENT units, from its arena's start, and aligns to 8 
+// bytes, so the minimum block stays at 16 bytes. Payloads are then only 
+// 8-byte aligned, below what the x86-64 ABI expects of malloc, so the 
+// drop-in library should not be built this way. FIRST_BLOCK is the offset 
+// of an arena's first block, past the word that names the arena. 
+#if !defined(__LP64__)
+#undef COMPACT_LINKS
+#endif
+#ifndef COMPACT_LINKS
+#define COMPACT_LINKS 0
+#endif
+#if defined(__LP64__) && COMPACT_LINKS
+#define ALIGNMENT     8
+#define PTR_SIZE      8
+#define HDR_SIZE      8
+#define FTR_SIZE      8
+#define HDR_FTR_SIZE  16
+#define MIN_BLK_SZ    16
+#define MIN_BLK_LOG2  4
+#define ALIGN_LOG2    3
+#define MAX_NBUCKETS  60
+#define FIRST_BLOCK   16
+#define LINK_REACH    ((size_t)1 << (32 + ALIGN_LOG2))    //bytes a link can span
+#elif defined(__LP64__)
+#define ALIGNMENT     16
+#define PTR_SIZE      8
+#define HDR_SIZE      8
+#define FTR_SIZE      8
+#define HDR_FTR_SIZE  16
+#define MIN_BLK_SZ    24
+#define MIN_BLK_LOG2  4
+#define ALIGN_LOG2    4
+#define MAX_NBUCKETS  60
+#define FIRST_BLOCK   16
+#else
 #define ALIGNMENT     8
 #define PTR_SIZE      4
 #define HDR_SIZE      4
 #define FTR_SIZE      4
 #define HDR_FTR_SIZE  8
 #define MIN_BLK_SZ    12
+#define MIN_BLK_LOG2  3
+#define ALIGN_LOG2    3
+#define MAX_NBUCKETS  30
+#define FIRST_BLOCK   8
+#endif
+
+// Headers and footers are one size_t word: size in the upper bits, then
+// the prev_alloc and curr_alloc bits. The largest block that fits the size
+// field, less a page so that rounding a request up can never wrap.
+#define WORD_BITS     (HDR_SIZE * 8)
+#define MAX_BLK_SZ    ((SIZE_MAX >> 2) - PAGE_SIZE)
 
-// Initial Number of Pages and Lists
-#define INIT_NPAGES   3
-#define NBUCKETS      30
+// A free block of at least ZERO_BLK_MIN bytes keeps, in the word after its
+// links, the payload offset from which it is known to be zero (up to its 
+// last two words, the release mark and footer), or 0 if nothing is known. 
+// mycalloc only clears what lies before that offset. 
+#define ZERO_MIN      (3 * PTR_SIZE)
+#define ZERO_BLK_MIN  (4 * PTR_SIZE)
 
 // Free is defined as 0, Allocated is defined as 1, 
 #define FREE        0
 #define ALLOC       1
 
-// Multipliers and cutoff to work with...
-#define REALLOC_MULT    1
+// Header bit 2 (the lowest size bit, always 0 for heap blocks since 
+// sizes are even) marks a block that is its own anonymous mapping
+#define MAPPED      0x4
+
+// Tuning policy. Each knob can be overridden at compile time (e.g. 
+// -DBUCKET_CUTOFF=8); `make variants` builds a replay binary per policy 
+// set and autotune.py sweeps them over the traces. 
+//      INIT_NPAGES      pages in a fresh arena
+//      NBUCKETS         segregated lists; larger sizes share the last one
+//      BUCKET_CUTOFF    blocks first fit examines per bucket
+//      BEST_FIT_CUTOFF  blocks best fit examines per bucket
+//      BEST1_FIRST0     1 for best fit, 0 for first fit
+//      REALLOC_MULT     factor by which a moving realloc overallocates
+//      SPLIT_FREE_FIRST 1 to split the free part off the front, 0 the back
+#ifndef INIT_NPAGES
+#define INIT_NPAGES     3
+#endif
+#ifndef NBUCKETS
+#define NBUCKETS        MAX_NBUCKETS
+#endif
+#ifndef BUCKET_CUTOFF
 #define BUCKET_CUTOFF   5
+#endif
+#ifndef BEST_FIT_CUTOFF
 #define BEST_FIT_CUTOFF 15
-
-// A\B Testing
+#endif
+#ifndef BEST1_FIRST0
 #define BEST1_FIRST0    0
+#endif
+#ifndef REALLOC_MULT
+#define REALLOC_MULT    1
+#endif
+#ifndef SPLIT_FREE_FIRST
+#define SPLIT_FREE_FIRST 1
+#endif
+#if NBUCKETS > MAX_NBUCKETS || NBUCKETS > MYSTATS_NBUCKETS
+#error "NBUCKETS is larger than the size field or struct mystats can use"
+#endif
+
+// Requests of at least MMAP_THRESHOLD bytes get their own anonymous 
+// mapping, unmapped on free and resized with mremap. Define it as 
+// SIZE_MAX to keep every request on the heap. 
+#ifndef MMAP_THRESHOLD
+#define MMAP_THRESHOLD  (256 * 1024)
+#endif
+
+// Regions (see myregion_create) bump through chunks of REGION_CHUNK bytes
+// taken from the heap with mymalloc. 
+#ifndef REGION_CHUNK
+#define REGION_CHUNK    (64 * 1024)
+#endif
+
+// Free pages go back to the OS with madvise(MADV_DONTNEED). The tail 
+// block before the epilogue is trimmed as soon as it reaches 
+// TRIM_THRESHOLD bytes. Interior pages of free blocks of at least 
+// SCAVENGE_MIN bytes are released once the arena has held unreleased 
+// blocks for DECAY_MS, checked on free or by the optional scavenger thread. 
+#ifndef SCAVENGE
+#define SCAVENGE        1
+#endif
+#define TRIM_THRESHOLD  (128 * 1024)
+#define SCAVENGE_MIN    (64 * 1024)
+#define DECAY_MS        1000
+
+// Build with -DHUGEPAGES=1 to back the heap with transparent huge pages. 
+// Every segment, slabs included, is aligned to HUGE_PAGE_SIZE, advised 
+// with MADV_HUGEPAGE and grown a whole huge page at a time, and scavenging
+// only gives back whole huge pages, so that a large heap (and the slabs 
+// holding small objects, which sit together in their own segment) needs 
+// far fewer TLB entries. Costs up to a huge page of slack per segment. 
+#ifndef HUGEPAGES
+#define HUGEPAGES       0
+#endif
+#if HUGEPAGES
+#define GROW_SIZE       HUGE_PAGE_SIZE
+#else
+#define GROW_SIZE       PAGE_SIZE
+#endif
+#define START_NPAGES    ((INIT_NPAGES * PAGE_SIZE + GROW_SIZE - 1) / GROW_SIZE * (GROW_SIZE / PAGE_SIZE))
+
+// Two-level segregated fit (TLSF) in place of first_fit/best_fit. Each 
+// power-of-two range is split into SL_COUNT linear lists (sizes below 
+// SMALL_BLOCK get one list per size), and bitmaps of non-empty lists 
+// make a fit two find-first-set operations. 
+#ifndef TLSF
+#define TLSF            0
+#endif
+#define SL_LOG2         4
+#define SL_COUNT        (1 << SL_LOG2)
+#define FL_SHIFT        (SL_LOG2 + ALIGN_LOG2)
+#define SMALL_BLOCK     ((size_t)1 << FL_SHIFT)
+#define FL_COUNT        (WORD_BITS - FL_SHIFT)
+#if TLSF
+#define NLISTS          (FL_COUNT * SL_COUNT)
+#else
+#define NLISTS          NBUCKETS
+#endif
+
+// Free blocks of at least TREE_MIN bytes (whole buckets, as it is a power
+// of two) leave the segregated lists for a per-arena treap keyed by 
+// (size, address). Its left and right links reuse the blocks' list links
+// and priorities are hashed from the address, so the index costs no 
+// memory, and a fit is the exact best fit in O(log n). TLSF builds keep 
+// their own lists. 
+#ifndef SIZE_TREE
+#define SIZE_TREE       1
+#endif
+#if TLSF
+#undef SIZE_TREE
+#define SIZE_TREE       0
+#endif
+#define TREE_MIN_LOG2   10
+#define TREE_MIN        ((size_t)1 << TREE_MIN_LOG2)
+#define TREE_HASH       ((size_t)0x9E3779B97F4A7C15ULL)     //golden ratio, odd
+#if SIZE_TREE
+#define LIST_BUCKETS    (TREE_MIN_LOG2 - MIN_BLK_LOG2)  //buckets below TREE_MIN
+#if NBUCKETS < LIST_BUCKETS
+#error "NBUCKETS must cover every size below TREE_MIN"
+#endif
+#else
+#define LIST_BUCKETS    NBUCKETS
+#endif
+
+// Build with -DFIT_CACHE=8 (or 4 or 16) to have each list bucket mirror 
+// the sizes and addresses of that many of its first nodes in the arena 
+// itself. A fit then compares those sizes four at a time with SSE2 and 
+// touches only the block it picks, and a walk past them adds the nodes it
+// visits. Off by default: with LIFO lists the nodes a fit examines were 
+// mostly just touched, so the upkeep on every insert and removal costs 
+// more than it saves (see readme.txt). Walks always prefetch each next 
+// node while testing the current one. 
+#ifndef FIT_CACHE
+#define FIT_CACHE       0
+#endif
+#if TLSF
+#undef FIT_CACHE
+#define FIT_CACHE       0
+#endif
+#if FIT_CACHE != 0 && FIT_CACHE != 4 && FIT_CACHE != 8 && FIT_CACHE != 16
+#error "FIT_CACHE must be 0, 4, 8 or 16"
+#endif
+
+// Per-thread cache of recently freed slots and blocks in the first 
+// TCACHE_NBUCKETS buckets. Each class caches at most TCACHE_COUNT blocks
+// and flushes them TCACHE_BATCH at a time, slot classes refill a batch 
+// at a time, and a thread caches at most TCACHE_BYTES bytes in all. 
+#ifndef TCACHE
+#define TCACHE          1
+#endif
+#define TCACHE_NBUCKETS 8
+#define TCACHE_COUNT    32
+#define TCACHE_BATCH    8
+#ifndef TCACHE_BYTES
+#define TCACHE_BYTES    (32 * 1024)
+#endif
+#if TCACHE && NBUCKETS <= TCACHE_NBUCKETS
+#error "NBUCKETS must exceed TCACHE_NBUCKETS"
+#endif
+
+// Deferred coalescing: heap blocks of the first QUICK_NCLASSES sizes are 
+// not coalesced on free but pushed, still marked allocated, onto per-arena
+// exact-size quick lists and reused LIFO. A list holding QUICK_COUNT 
+// blocks coalesces its older half, and a failed fit coalesces them all. 
+#ifndef QUICKLIST
+#define QUICKLIST       0
+#endif
+#define QUICK_NCLASSES  32
+#define QUICK_COUNT     64
+
+// Requests of at most SLAB_MAX_SZ bytes are served from slabs: page-sized 
+// runs of equal slots with no per-object header. Slot sizes step by 
+// SLAB_QUANTUM, rounded up to ALIGNMENT once they reach it (4, 8, 16 on
+// IA32; 8, 16, 32 on x86-64), and every slab page comes from one 
+// SLAB_RESERVE reservation so slots are recognized by address alone. 
+#ifndef SLAB
+#define SLAB            1
+#endif
+#define SLAB_QUANTUM    PTR_SIZE
+#define SLAB_MAX_SZ     MIN_BLK_SZ
+#define NSLAB_CLASSES   (SLAB_MAX_SZ / SLAB_QUANTUM)
+#define SLAB_BITMAP_WORDS (PAGE_SIZE / SLAB_QUANTUM / (8 * sizeof(unsigned long)))
+#if defined(__LP64__)
+#define SLAB_RESERVE    ((size_t)1 << 32)
+#else
+#define SLAB_RESERVE    ((size_t)1 << 26)
+#endif
+
+// The thread cache indexes slab classes first, then heap buckets
+#if SLAB
+#define TCACHE_NSLABS   NSLAB_CLASSES
+#else
+#define TCACHE_NSLABS   0
+#endif
+#define TCACHE_NCLASSES (TCACHE_NSLABS + TCACHE_NBUCKETS)
+
+// Independent heaps that threads are spread across. Arena 0 starts in a 
+// SEGMENT_RESERVE segment; the others each reserve ARENA_RESERVE bytes of
+// address space aligned to ARENA_RESERVE, so a pointer's arena is found by 
+// masking. An arena whose last segment is full adds another such aligned 
+// segment, up to NSEGMENTS in all. Compact links only reach within the 
+// first segment, so COMPACT_LINKS builds keep to one. 
+#ifndef NARENAS
+#define NARENAS         8
+#endif
+#if defined(__LP64__)
+#define ARENA_RESERVE   ((size_t)1 << 32)
+#else
+#define ARENA_RESERVE   ((size_t)1 << 26)
+#endif
+#ifndef NSEGMENTS
+#define NSEGMENTS       16
+#endif
+#if COMPACT_LINKS
+#undef NSEGMENTS
+#define NSEGMENTS       1
+#endif
+
+// A block freed by a thread attached to another arena is pushed onto that
+// arena's lock-free stack of remote frees instead of taking its lock, and 
+// the next thread to lock the arena for an allocation frees the lot. 
+#ifndef REMOTE_FREE
+#define REMOTE_FREE     1
+#endif
+
+// Counters reported by mystats. Each arena keeps its own set, bumped with
+// relaxed atomics so that lock-free paths can count too; mystats sums them.
+// Build with -DSTATS=1 to enable; otherwise the counters compile away. 
+#ifndef STATS
+#define STATS           0
+#endif
+#if STATS
+#define STAT_ADD(a, field, n)   __atomic_fetch_add(&(a)->stats.field, (n), __ATOMIC_RELAXED)
+#else
+#define STAT_ADD(a, field, n)   ((void)0)
+#endif
+
+// Sampling heap profiler (see myprofile_start). Compiled in by default;
+// while stopped it costs a thread-local countdown per malloc and a load
+// per free. Build with -DPROFILE=0 to drop it altogether. Backtraces are
+// PROFILE_DEPTH frames deep, and the tables hold PROFILE_STACKS distinct
+// stacks and PROFILE_LIVE sampled blocks still allocated.
+#ifndef PROFILE
+#define PROFILE         1
+#endif
+#define PROFILE_DEPTH   32
+#define PROFILE_STACKS  (1 << 12)
+#define PROFILE_LIVE    (1 << 16)
+
+/* An arena is a complete heap: its own segment, segregated lists and
+ * epilogue, guarded by its own lock. 
+ */
+struct arena {
+    pthread_mutex_t lock;           //guards everything below
+    void **free_list[NLISTS];       //segregated free lists
+#if SIZE_TREE
+    void *size_tree;                //root of the treap of large free blocks
+#endif
+#if TLSF
+    unsigned long fl_bitmap;        //first levels with a non-empty list
+    unsigned int sl_bitmap[FL_COUNT];   //non-empty lists per first level
+#endif
+#if FIT_CACHE
+    uint32_t fit_size[LIST_BUCKETS][FIT_CACHE] __attribute__((aligned(16)));  //candidate sizes (0 if empty slot)
+    void *fit_blk[LIST_BUCKETS][FIT_CACHE];     //candidates: the first nodes of each list, as a ring
+    unsigned char fit_head[LIST_BUCKETS];       //slot of the list's first node
+    unsigned char fit_count[LIST_BUCKETS];      //nodes mirrored (fewer if some left the front)
+#endif
+    struct slab *slabs[NSLAB_CLASSES];  //slabs with free slots, per class
+    struct segment segs[NSEGMENTS]; //the heap, in segs[0] then overflow segments
+    int nsegs;                      //segments in use (the last one grows)
+    int nthreads;                   //threads currently attached (load)
+    unsigned long dirty_since;      //ms since large free blocks went unreleased (0 if none)
+#if QUICKLIST
+    void *quick[QUICK_NCLASSES];    //exact-size stacks of uncoalesced blocks
+    int quick_count[QUICK_NCLASSES];
+    int quick_total;                //blocks across all quick lists
+#endif
+#if STATS
+    struct mystats stats;           //this arena's share of the counters
+#endif
+#if REMOTE_FREE
+    void *remote __attribute__((aligned(64)));  //blocks other threads freed (lock-free, own line)
+#endif
+} __attribute__((aligned(64)));     //keep arenas off each other's cache lines
+
+/* A slab is one page: this header, then nslots equal slots of 
+ * get_slot_size(cls) bytes. A slot's bit in the bitmap is set while the
+ * slot is free. Everything but arena is guarded by the owning arena's 
+ * lock. 
+ */
+struct slab {
+    struct arena *arena;            //owner, fixed while any slot is live
+    struct slab *next;              //other slabs of this class with free slots
+    struct slab *prev;
+    int cls;                        //size class
+    int nslots;                     //slots in this page
+    int nfree;                      //slots not handed out
+    unsigned long bitmap[SLAB_BITMAP_WORDS];
+};
+#define SLAB_HDR_SZ   roundup(sizeof(struct slab), ALIGNMENT)
 
 /* Private Global Variables */
-static void **free_list[NBUCKETS];  //segregated free lists
-static void *heap_start;            //start address of the heap segment
+static struct arena arenas[NARENAS] = {
+    [0 ... NARENAS - 1] = { .lock = PTHREAD_MUTEX_INITIALIZER }
+};
+static pthread_mutex_t arena_attach_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int heap_gen;       //bumped by myinit to invalidate thread state
+static struct segment slab_seg;     //the slab range; pages past its size never handed out
+#if SLAB
+static void *slab_pages;            //stack of released slab pages
+#endif
+static pthread_mutex_t slab_lock = PTHREAD_MUTEX_INITIALIZER;   //guards the two above
+static size_t mapped_bytes;         //held by mapped blocks (updated atomically)
 
 
 
@@ -77,9 +447,9 @@ static inline void *get_hdr_addr(void *bp)
  * --------------------------
  * Helper function to manipulate the bits of an address.  
  */
-static inline unsigned int get(void *p) 
+static inline size_t get(void *p) 
 {
-    return *(unsigned int *)(p);
+    return *(size_t *)(p);
 }
 
 /* Block Function: get_size, set_size
@@ -87,14 +457,14 @@ static inline unsigned int get(void *p)
  * Getters and setters for size of the block (stored in the 
  * header) when passed the address of a header or a footer. 
  */
-static inline unsigned int get_size(void *p)
+static inline size_t get_size(void *p)
 {
     return get(p) >> 2;
 }
 
-static inline void set_size(void *p, unsigned int size)
+static inline void set_size(void *p, size_t size)
 {
-    *(unsigned int *)p = ((get(p) & 0x3) | (size << 2));
+    *(size_t *)p = ((get(p) & 0x3) | (size << 2));
 }
 
 /* Block Function: get_hdr_addr, set_hdr_size
@@ -102,12 +472,12 @@ static inline void set_size(void *p, unsigned int size)
  * Getters and setters for size of the block (stored in the 
  * header) when passed the base address of a block. 
  */
-static inline unsigned int get_hdr_size(void *bp)
+static inline size_t get_hdr_size(void *bp)
 {
     return get_size(get_hdr_addr(bp));
 }
 
-static inline void set_hdr_size(void *bp, int size)
+static inline void set_hdr_size(void *bp, size_t size)
 {
     set_size(get_hdr_addr(bp), size);
 }
@@ -126,7 +496,7 @@ static inline void set_hdr_size(void *bp, int size)
 static inline void set_curr_alloc(void *bp, int curr_alloc) 
 {
     void *hdr_addr = get_hdr_addr(bp);
-    *(unsigned int *)hdr_addr = ((get(hdr_addr) & ~0x1) | curr_alloc);
+    *(size_t *)hdr_addr = ((get(hdr_addr) & ~(size_t)0x1) | curr_alloc);
 }
 
 /* Block Function: get_prev_alloc, set_prev_alloc
@@ -144,7 +514,7 @@ static inline int get_prev_alloc(void *bp)
 static inline void set_prev_alloc(void *bp, int prev_alloc)
 {
     void *hdr_addr = get_hdr_addr(bp); 
-    *(unsigned int *)hdr_addr = ((get(hdr_addr) & ~0x2) | (prev_alloc << 1));
+    *(size_t *)hdr_addr = ((get(hdr_addr) & ~(size_t)0x2) | (prev_alloc << 1));
 }
 
 /* Block Function: get_next_block, get_prev_block
@@ -166,18 +536,62 @@ static inline void *get_prev_block(void *bp)
     return (char *)bp - HDR_SIZE - get_size(ftr_addr);
 }
 
+#if COMPACT_LINKS
+/* Block Helper: link_to_block, block_to_link
+ * ------------------------------------------
+ * Convert between a block and the 32-bit link that names it: its offset
+ * from the arena's start in ALIGNMENT units, with 0 for NULL (no block
+ * starts at the arena's first byte). 
+ */
+static inline void *link_to_block(struct arena *a, uint32_t link)
+{
+    return link == 0 ? NULL : a->segs[0].base + ((size_t)link << ALIGN_LOG2);
+}
+
+static inline uint32_t block_to_link(struct arena *a, void *bp)
+{
+    return bp == NULL ? 0 : ((char *)bp - a->segs[0].base) >> ALIGN_LOG2;
+}
+
+/* Block Function: get_next, set_next, get_prev, set_prev
+ * ------------------------------------------------------
+ * Getters and setters for the links to the next and previous blocks 
+ * in the free list of the arena a, stored as 32-bit offsets. Passed 
+ * the base address of a free block. 
+ */
+static inline void *get_next(struct arena *a, void *bp)
+{
+    return link_to_block(a, *(uint32_t *)bp);
+}
+
+static inline void set_next(struct arena *a, void *bp, void *next_bp)
+{
+    *(uint32_t *)bp = block_to_link(a, next_bp);
+}
+
+static inline void *get_prev(struct arena *a, void *bp)
+{
+    return link_to_block(a, *((uint32_t *)bp + 1));
+}
+
+static inline void set_prev(struct arena *a, void *bp, void *prev_bp)
+{
+    *((uint32_t *)bp + 1) = block_to_link(a, prev_bp);
+}
+#else
 /* Block Function: get_next, set_next
  * ----------------------------------
  * Getters and setters for pointers to the next blocks
  * in the free list for a given free block. Passed the base 
- * address of a free block. 
+ * address of a free block (and its arena, which COMPACT_LINKS 
+ * needs). 
  */
-static inline void *get_next(void *bp)
+static inline void *get_next(struct arena *a, void *bp)
 {
     return *(void **)bp;
 }
 
-static inline void set_next(void *bp, void *next_bp)
+static inline void set_next(struct arena *a, void *bp, void *next_bp)
 {
     *(void **)bp = next_bp; 
 }
@@ -188,15 +602,32 @@ static inline void set_next(void *bp, void *next_bp)
  * in the free list for a given free block. Passed the base 
  * address of a free block. 
  */
-static inline void *get_prev(void *bp)
+static inline void *get_prev(struct arena *a, void *bp)
 {
     return *(void **)((char *)bp + sizeof(void *));
 }
 
-static inline void set_prev(void *bp, void *prev_bp)
+static inline void set_prev(struct arena *a, void *bp, void *prev_bp)
 {
     *(void **)((char *)bp + sizeof(void *)) = prev_bp;
 }
+#endif
+
+/* Block Function: get_stack_next, set_stack_next
+ * ----------------------------------------------
+ * Getter and setter for the link of the singly linked stacks of 
+ * allocated blocks (quick lists and thread caches). Always a full 
+ * pointer, which the payload of any heap block has room for. 
+ */
+static inline void *get_stack_next(void *bp)
+{
+    return *(void **)bp;
+}
+
+static inline void set_stack_next(void *bp, void *next_bp)
+{
+    *(void **)bp = next_bp; 
+}
 
 /* Block Function: write_header
  * ----------------------------
@@ -204,7 +635,7 @@ static inline void set_prev(void *bp, void *prev_bp)
  * allocation status of the current and previous blocks. Passed
  * the base address of a block.
  */
-static inline void write_header(void *bp, int size, int curr_alloc, int prev_alloc) 
+static inline void write_header(void *bp, size_t size, int curr_alloc, int prev_alloc) 
 {
     set_hdr_size(bp, size);
     set_curr_alloc(bp, curr_alloc);
@@ -232,6 +663,22 @@ static inline void write_footer(void *bp)
     memcpy(get_ftr_addr(bp), get_hdr_addr(bp), FTR_SIZE);
 }
 
+/* Block Function: get_zero_from, set_zero_from
+ * --------------------------------------------
+ * Getter and setter for the offset from which a free block's payload 
+ * is known to be zero (0 if unknown). Blocks too small to hold the word
+ * always report 0. Set the block's size first. 
+ */
+static inline size_t get_zero_from(void *bp)
+{
+    if (get_hdr_size(bp) < ZERO_BLK_MIN) return 0;
+    return *(size_t *)((char *)bp + 2 * PTR_SIZE);
+}
+
+static inline void set_zero_from(void *bp, size_t offset)
+{
+    if (get_hdr_size(bp) >= ZERO_BLK_MIN) *(size_t *)((char *)bp + 2 * PTR_SIZE) = offset;
+}
 
 /* Block Helper: roundup
  * ---------------------
@@ -240,7 +687,7 @@ static inline void write_footer(void *bp)
  * the bottom bits, result is power of mult. 
  * NOTE: mult has to be power of 2 for this trick to work!
  */
-static inline size_t roundup(size_t sz, int mult)
+static inline size_t roundup(size_t sz, size_t mult)
 {
    return (sz + mult-1) & ~(mult-1);
 }
@@ -250,13 +697,14 @@ static inline size_t roundup(size_t sz, int mult)
  * Adjusts the size of a request to find the associated size 
  * of a block given size and alignment constraints. The adjusted
  * size will always be at least the size of the request. The 
- * adjusted size cannot be smaller than 12 bytes, otherwise 
- * adjustedsz is a size of 12 + (8 * n), where n is a natural number. 
+ * adjusted size cannot be smaller than MIN_BLK_SZ, otherwise 
+ * adjustedsz is a size of MIN_BLK_SZ + (ALIGNMENT * n), where n is 
+ * a natural number (12 + 8n on IA32, 24 + 16n on x86-64). 
  */
 static inline size_t adjust_block_size(size_t requestedsz)
 {
     if (requestedsz <= MIN_BLK_SZ)  return MIN_BLK_SZ;
-    else                            return roundup(requestedsz - 4, ALIGNMENT) + 4;
+    else                            return roundup(requestedsz - HDR_SIZE, ALIGNMENT) + HDR_SIZE;
 }
 
 /**** **** ****         Segregated Free List Functions      **** **** ****/
@@ -266,7 +714,9 @@ static inline size_t adjust_block_size(size_t requestedsz)
 /* Seglist Helper: get_bucket_num
  * ------------------------------
  * Uses the size of the block to determine bucket placement.
- * Returns a bucket number from 0 to 28.
+ * Returns a bucket number from 0 to NBUCKETS - 1 (bucket 0 holds 
+ * blocks from MIN_BLK_SZ up to the next power of two, and the last 
+ * bucket everything beyond its lower bound). 
  */
 static inline int get_bucket_num(size_t size)
 {    
@@ -279,30 +729,166 @@ static inline int get_bucket_num(size_t size)
     if (bucket_num > NBUCKETS - 1) bucket_num = NBUCKETS - 1;
     return bucket_num; */
 
-    return NBUCKETS - __builtin_clz(size) - 2;  //number of leading 0's
+    int bucket = WORD_BITS - MIN_BLK_LOG2 - 1 - __builtin_clzl(size);  //number of leading 0's
+#if NBUCKETS < MAX_NBUCKETS
+    if (bucket > NBUCKETS - 1) bucket = NBUCKETS - 1;
+#endif
+    return bucket;
+}
+
+#if FIT_CACHE
+/* Seglist Helper: fit_key, fit_slot
+ * ---------------------------------
+ * A block size as stored among the candidates, saturated to 32 bits, 
+ * and the slot of bucket i's ring holding the candidate at list 
+ * position pos. 
+ */
+static inline uint32_t fit_key(size_t size)
+{
+    return size < UINT32_MAX ? size : UINT32_MAX;
+}
+
+static inline int fit_slot(struct arena *a, int i, int pos)
+{
+    return (a->fit_head[i] + pos) & (FIT_CACHE - 1);
+}
+
+/* Seglist Helper: fit_cache_match
+ * -------------------------------
+ * Returns a bitmask, by list position, of the first n candidates of 
+ * bucket i that are at least target_size bytes. The sizes are compared 
+ * four per instruction and the mask rotated from ring to list order. 
+ */
+static inline unsigned int fit_cache_match(struct arena *a, int i, int n, size_t target_size)
+{
+    const uint32_t *sizes = a->fit_size[i];
+    unsigned int mask = 0;
+    if (target_size >= UINT32_MAX) return 0;
+#if defined(__SSE2__)
+    // SSE2 only compares signed lanes, so flip the sign bit of both sides
+    __m128i bias = _mm_set1_epi32(INT32_MIN);
+    __m128i below = _mm_xor_si128(_mm_set1_epi32((int)(target_size - 1)), bias);
+    for (int j = 0; j < FIT_CACHE; j += 4) {
+        __m128i sz = _mm_xor_si128(_mm_load_si128((const __m128i *)&sizes[j]), bias);
+        mask |= (unsigned int)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(sz, below))) << j;
+    }
+#else
+    for (int j = 0; j < FIT_CACHE; j++) mask |= (unsigned int)(sizes[j] >= target_size) << j;
+#endif
+    mask = (mask | mask << FIT_CACHE) >> a->fit_head[i];
+    return mask & ((1U << n) - 1);
+}
+
+/* Seglist Helper: fit_cache_push, fit_cache_append
+ * ------------------------------------------------
+ * Keep the candidates of bucket i in step with its list: push a block 
+ * inserted at the front (overwriting the last candidate if the ring is 
+ * full), and append the node that follows the candidates when a walk 
+ * reaches it. 
+ */
+static inline void fit_cache_push(struct arena *a, int i, void *bp, size_t size)
+{
+    int j = (a->fit_head[i] - 1) & (FIT_CACHE - 1);
+    a->fit_head[i] = j;
+    a->fit_size[i][j] = fit_key(size);
+    a->fit_blk[i][j] = bp;
+    if (a->fit_count[i] < FIT_CACHE) a->fit_count[i]++;
+}
+
+static inline void fit_cache_append(struct arena *a, int i, void *bp, size_t size)
+{
+    if (a->fit_count[i] == FIT_CACHE) return;
+    int j = fit_slot(a, i, a->fit_count[i]++);
+    a->fit_size[i][j] = fit_key(size);
+    a->fit_blk[i][j] = bp;
+}
+
+/* Seglist Helper: fit_cache_drop, fit_cache_resize
+ * ------------------------------------------------
+ * Forget a block leaving bucket i's list, moving the candidates before 
+ * it back one slot so that the rest remain the list's first nodes (a 
+ * block taken from the front just advances the ring), and follow a 
+ * block whose size changed within the bucket. 
+ */
+static inline void fit_cache_drop(struct arena *a, int i, void *bp)
+{
+    int pos = 0;
+    while (pos < a->fit_count[i] && a->fit_blk[i][fit_slot(a, i, pos)] != bp) pos++;
+    if (pos == a->fit_count[i]) return;
+    for (; pos > 0; pos--) {
+        int to = fit_slot(a, i, pos), from = fit_slot(a, i, pos - 1);
+        a->fit_size[i][to] = a->fit_size[i][from];
+        a->fit_blk[i][to] = a->fit_blk[i][from];
+    }
+    a->fit_head[i] = fit_slot(a, i, 1);
+    a->fit_count[i]--;
+}
+
+static inline void fit_cache_resize(struct arena *a, int i, void *bp, size_t size)
+{
+    for (int pos = 0; pos < a->fit_count[i]; pos++) {
+        int j = fit_slot(a, i, pos);
+        if (a->fit_blk[i][j] == bp) a->fit_size[i][j] = fit_key(size);
+    }
 }
+#endif
 
+#if !TLSF
 /* Seglist Helper: first_fit
  * -------------------------
  * Searches for the first free block that is at least as large
  * as the target_size. Starts at the front of a corresponding 
- * bucket list, and continues down 
+ * bucket list, and continues down. The first FIT_CACHE nodes 
+ * are tested at once from the bucket's candidates, and the walk 
+ * past them adds the nodes it visits. 
  */
-void *first_fit(size_t target_size)
+static void *first_fit(struct arena *a, size_t target_size)
 {
     // Searches through increasing buckets
     int bucket = get_bucket_num(target_size);
-    for (int i = bucket; i < NBUCKETS; i++) {
-        // Searches down the bucket list for a large enough block
+    for (int i = bucket; i < LIST_BUCKETS; i++) {
         int n_blocks_examined = 0;
-        for (void *curr = free_list[i]; curr != NULL; curr = get_next(curr)) {
+        void *curr = a->free_list[i];
+#if FIT_CACHE
+        int ntest = a->fit_count[i] < BUCKET_CUTOFF ? a->fit_count[i] : BUCKET_CUTOFF;
+        unsigned int match = fit_cache_match(a, i, ntest, target_size);
+        if (match != 0) {
+            STAT_ADD(a, fit_examined[i], __builtin_ctz(match) + 1);
+            STAT_ADD(a, fit_cache_hits, 1);
+            return a->fit_blk[i][fit_slot(a, i, __builtin_ctz(match))];
+        }
+        if (ntest == BUCKET_CUTOFF) {
+            STAT_ADD(a, fit_examined[i], ntest);
+            STAT_ADD(a, cutoff_hits, 1);
+            continue;
+        }
+        if (ntest > 0) curr = get_next(a, a->fit_blk[i][fit_slot(a, i, ntest - 1)]);
+        n_blocks_examined = ntest;
+#endif
+        // Searches down the bucket list for a large enough block
+        void *next;
+        for (; curr != NULL; curr = next) {
             // Exit from this bucket early if not promising...
-            if (n_blocks_examined == BUCKET_CUTOFF) break;
+            if (n_blocks_examined == BUCKET_CUTOFF) {
+                STAT_ADD(a, cutoff_hits, 1);
+                break;
+            }
             n_blocks_examined++; 
 
-            int curr_size = get_hdr_size(curr);
-            if (curr_size >= target_size) return curr; //found a large enough block
+            // Start loading the next node while this one is tested
+            next = get_next(a, curr);
+            if (next != NULL) __builtin_prefetch(get_hdr_addr(next));
+
+            size_t curr_size = get_hdr_size(curr);
+#if FIT_CACHE
+            fit_cache_append(a, i, curr, curr_size);
+#endif
+            if (curr_size >= target_size) {
+                STAT_ADD(a, fit_examined[i], n_blocks_examined);
+                return curr; //found a large enough block
+            }
         }
+        STAT_ADD(a, fit_examined[i], n_blocks_examined);
     }
     return NULL;    //no free blocks large enough found in any buckets
 }
@@ -312,393 +898,3342 @@ void *first_fit(size_t target_size)
  * -------------------------
  * Searches for the best block that is at least as large
  * as the target_size. Starts at the front of a corresponding 
- * bucket list, and continues down. If none found, continues
- * to the next bucket.
+ * bucket list, and continues down, taking the first FIT_CACHE 
+ * nodes from the bucket's candidates as first_fit does. If none 
+ * found, continues to the next bucket.
  */
-void *best_fit(size_t target_size)
+static void *best_fit(struct arena *a, size_t target_size)
 {
     int bucket = get_bucket_num(target_size);
-    for (int i = bucket; i < NBUCKETS; i++) {
+    for (int i = bucket; i < LIST_BUCKETS; i++) {
         // Searches down the bucket list for a large enough block
         int n_blocks_examined = 0;
 
-        int smallest_diff = INT_MAX;
+        size_t smallest_diff = SIZE_MAX;
         void *best_fit_blk = NULL;
-        for (void *curr = free_list[i]; curr != NULL; curr = get_next(curr)) {
+        void *curr = a->free_list[i];
+#if FIT_CACHE
+        int ntest = a->fit_count[i] < BEST_FIT_CUTOFF ? a->fit_count[i] : BEST_FIT_CUTOFF;
+        unsigned int match = fit_cache_match(a, i, ntest, target_size);
+        for (; match != 0; match &= match - 1) {
+            int j = fit_slot(a, i, __builtin_ctz(match));
+            if (a->fit_size[i][j] - target_size < smallest_diff) {
+                smallest_diff = a->fit_size[i][j] - target_size;
+                best_fit_blk = a->fit_blk[i][j];
+            }
+        }
+        n_blocks_examined = ntest;
+        if (ntest == BEST_FIT_CUTOFF) curr = NULL;
+        else if (ntest > 0) curr = get_next(a, a->fit_blk[i][fit_slot(a, i, ntest - 1)]);
+        if (best_fit_blk != NULL) STAT_ADD(a, fit_cache_hits, 1);
+#endif
+        void *next;
+        for (; curr != NULL; curr = next) {
             // Exit from this bucket early if not promising...
-            if (n_blocks_examined == BEST_FIT_CUTOFF) break;
+            if (n_blocks_examined == BEST_FIT_CUTOFF) {
+                STAT_ADD(a, cutoff_hits, 1);
+                break;
+            }
             n_blocks_examined++; 
 
-            int curr_size = get_hdr_size(curr);
-            int curr_diff = curr_size - target_size; 
+            // Start loading the next node while this one is tested
+            next = get_next(a, curr);
+            if (next != NULL) __builtin_prefetch(get_hdr_addr(next));
+
+            size_t curr_size = get_hdr_size(curr);
+            size_t curr_diff = curr_size - target_size; 
+#if FIT_CACHE
+            fit_cache_append(a, i, curr, curr_size);
+#endif
 
-            if (curr_diff >= 0 && curr_diff < smallest_diff) {
+            if (curr_size >= target_size && curr_diff < smallest_diff) {
                 smallest_diff = curr_diff; 
                 best_fit_blk = curr; 
             }
         }
+        STAT_ADD(a, fit_examined[i], n_blocks_examined);
         if (best_fit_blk != NULL) return best_fit_blk;
     }
     return NULL;    //no free blocks large enough found in any buckets}
 }
+#endif
+
+/* Seglist Helper: tlsf_mapping
+ * ----------------------------
+ * Maps a size to its TLSF first level (power-of-two range) and second 
+ * level (linear slice of that range). Sizes below SMALL_BLOCK all share
+ * first level 0, one list per ALIGNMENT step. 
+ */
+static inline void tlsf_mapping(size_t size, int *fl, int *sl)
+{
+    if (size < SMALL_BLOCK) {
+        *fl = 0;
+        *sl = size >> ALIGN_LOG2;
+    } else {
+        int log2 = WORD_BITS - 1 - __builtin_clzl(size);
+        *fl = log2 - FL_SHIFT + 1;
+        *sl = (size >> (log2 - SL_LOG2)) ^ SL_COUNT;
+    }
+}
+
+/* Seglist Helper: get_list_num
+ * ----------------------------
+ * Index of the free list that holds blocks of the given size: the 
+ * power-of-two bucket, or the flattened TLSF (fl, sl) pair. 
+ */
+static inline int get_list_num(size_t size)
+{
+#if TLSF
+    int fl, sl;
+    tlsf_mapping(size, &fl, &sl);
+    return fl * SL_COUNT + sl;
+#else
+    return get_bucket_num(size);
+#endif
+}
+
+#if TLSF
+/* Seglist Helper: tlsf_fit
+ * ------------------------
+ * Rounds the target up to the next list boundary, so that every block 
+ * on the list it maps to is large enough, then finds the first 
+ * non-empty list at or above it with two find-first-set operations. 
+ * Returns the head of that list, or NULL if no list qualifies. 
+ */
+static void *tlsf_fit(struct arena *a, size_t target_size)
+{
+    if (target_size >= SMALL_BLOCK) {
+        int log2 = WORD_BITS - 1 - __builtin_clzl(target_size);
+        target_size += ((size_t)1 << (log2 - SL_LOG2)) - 1;
+    }
+    int fl, sl;
+    tlsf_mapping(target_size, &fl, &sl);
+
+    unsigned int sl_map = a->sl_bitmap[fl] & (~0U << sl);
+    if (sl_map == 0) {
+        // Nothing left in this range; take the next non-empty range
+        unsigned long fl_map = a->fl_bitmap & (~0UL << (fl + 1));
+        if (fl_map == 0) return NULL;
+        fl = __builtin_ctzl(fl_map);
+        sl_map = a->sl_bitmap[fl];
+    }
+    sl = __builtin_ctz(sl_map);
+    return a->free_list[fl * SL_COUNT + sl];
+}
+#endif
+
+#if SIZE_TREE
+/* Tree Helper: tree_left, tree_right
+ * ----------------------------------
+ * Addresses of the child links of a block in the size tree, which 
+ * occupy the words that hold next and prev on a free list. 
+ */
+static inline void **tree_left(void *bp)
+{
+    return (void **)bp;
+}
+
+static inline void **tree_right(void *bp)
+{
+    return (void **)((char *)bp + sizeof(void *));
+}
+
+/* Tree Helper: tree_less, tree_priority
+ * -------------------------------------
+ * Order of the size tree: by size, then by address. The heap order 
+ * comes from a multiplicative hash of the address, which gives the 
+ * treap its expected logarithmic depth without storing anything. 
+ */
+static inline bool tree_less(size_t size, void *bp, void *node)
+{
+    size_t node_size = get_hdr_size(node);
+    return size < node_size || (size == node_size && bp < node);
+}
+
+static inline size_t tree_priority(void *bp)
+{
+    return (uintptr_t)bp * TREE_HASH;
+}
+
+/* Tree Function: tree_insert
+ * --------------------------
+ * Inserts a free block of the given size. Walks down while the nodes 
+ * outrank the block, then splits the subtree below by key into the 
+ * block's two children. 
+ */
+static void tree_insert(struct arena *a, void *free_block, size_t size)
+{
+    size_t priority = tree_priority(free_block);
+    void **link = &a->size_tree;
+    while (*link != NULL && tree_priority(*link) > priority) {
+        link = tree_less(size, free_block, *link) ? tree_left(*link) : tree_right(*link);
+    }
+
+    void *rest = *link;
+    void **left = tree_left(free_block);
+    void **right = tree_right(free_block);
+    while (rest != NULL) {
+        if (tree_less(size, free_block, rest)) {
+            *right = rest;
+            right = tree_left(rest);
+            rest = *right;
+        } else {
+            *left = rest;
+            left = tree_right(rest);
+            rest = *left;
+        }
+    }
+    *left = NULL;
+    *right = NULL;
+    *link = free_block;
+}
+
+/* Tree Function: tree_remove
+ * --------------------------
+ * Removes a free block filed under the given size (its header may 
+ * already hold a new one) and merges its children in its place. 
+ */
+static void tree_remove(struct arena *a, void *free_block, size_t size)
+{
+    void **link = &a->size_tree;
+    while (*link != free_block) {
+        link = tree_less(size, free_block, *link) ? tree_left(*link) : tree_right(*link);
+    }
+
+    void *left = *tree_left(free_block);
+    void *right = *tree_right(free_block);
+    while (left != NULL && right != NULL) {
+        if (tree_priority(left) > tree_priority(right)) {
+            *link = left;
+            link = tree_right(left);
+            left = *link;
+        } else {
+            *link = right;
+            link = tree_left(right);
+            right = *link;
+        }
+    }
+    *link = left != NULL ? left : right;
+}
+
+/* Tree Function: tree_fit
+ * -----------------------
+ * Returns the smallest free block in the tree of at least target_size 
+ * bytes (the lowest addressed among equals), or NULL if none is. 
+ */
+static void *tree_fit(struct arena *a, size_t target_size)
+{
+    void *best = NULL;
+    int n_nodes_examined = 0;
+    for (void *curr = a->size_tree; curr != NULL; n_nodes_examined++) {
+        if (get_hdr_size(curr) >= target_size) {
+            best = curr;
+            curr = *tree_left(curr);
+        } else {
+            curr = *tree_right(curr);
+        }
+    }
+    STAT_ADD(a, fit_examined[get_bucket_num(target_size < TREE_MIN ? TREE_MIN : target_size)], n_nodes_examined);
+    return best;
+}
+#endif
 
 /* Seglist Function: insert_free_list
  * ----------------------------------
  * Inserts a free block at the front of its corresponding bucket
- * list (FILO). Rearranges pointers as necessary. 
+ * list (FILO), or into the size tree if it is large enough. 
+ * Rearranges pointers as necessary. 
  */
-static inline void insert_free_list(void* free_block)
+static inline void insert_free_list(struct arena *a, void* free_block)
 {   
     // Find the corresponding bucket and the first block (if any) of that bucket
     size_t size = get_hdr_size(free_block);
-    int bucket_num = get_bucket_num(size);
-    void *next_block = free_list[bucket_num];  
+#if SIZE_TREE
+    if (size >= TREE_MIN) {
+        tree_insert(a, free_block, size);
+        return;
+    }
+#endif
+    int bucket_num = get_list_num(size);
+    void *next_block = a->free_list[bucket_num];  
 
     // Set the next and prev pointers of the new block
-    set_next(free_block, next_block);
-    set_prev(free_block, &free_list[bucket_num]);
+    set_next(a, free_block, next_block);
+#if COMPACT_LINKS
+    set_prev(a, free_block, NULL);          //a list head has no offset
+#else
+    set_prev(a, free_block, &a->free_list[bucket_num]);
+#endif
 
     // If list was non-empty, update its previous pointer
-    if (next_block != NULL) set_prev(next_block, free_block);
+    if (next_block != NULL) set_prev(a, next_block, free_block);
 
     // Have the front of the free list point to the new block
-    free_list[bucket_num] = free_block;    
+    a->free_list[bucket_num] = free_block;    
+#if FIT_CACHE
+    fit_cache_push(a, bucket_num, free_block, size);
+#endif
+#if TLSF
+    a->fl_bitmap |= 1UL << (bucket_num / SL_COUNT);
+    a->sl_bitmap[bucket_num / SL_COUNT] |= 1U << (bucket_num % SL_COUNT);
+#endif
 }
 
-/* Seglist Function: remove_free_list
- * ----------------------------------
+/* Seglist Function: unlink_free_list, remove_free_list
+ * ----------------------------------------------------
  * Removes a free block from its current list and updates the pointers
  * of the previous and next blocks in the list to point to one another.
+ * Blocks in the size tree are found by key, and in TLSF mode the 
+ * bitmap bit of a list left empty is cleared, so unlink_free_list is 
+ * told the size the block was filed under (its header may already hold
+ * a new one); remove_free_list reads it from the header. 
  */
-static inline void remove_free_list(void *free_block)
+static inline void unlink_free_list(struct arena *a, void *free_block, size_t size)
 {
+#if SIZE_TREE
+    if (size >= TREE_MIN) {
+        tree_remove(a, free_block, size);
+        return;
+    }
+#endif
     // Previous and next (if any) blocks in the free list
-    void *prev_block = get_prev(free_block);
-    void *next_block = get_next(free_block);
+    void *prev_block = get_prev(a, free_block);
+    void *next_block = get_next(a, free_block);
 
     // Have the next pointer of the previous block point to 
     // the next block (NULL if end of list). 
-    set_next(prev_block, next_block);
+#if COMPACT_LINKS
+    if (prev_block == NULL) a->free_list[get_list_num(size)] = next_block;
+    else set_next(a, prev_block, next_block);
+#else
+    set_next(a, prev_block, next_block);
+#endif
 
     // If the free block is not at the end of the list, set 
     // previous pointer of the next block point to the previous block. 
-    if (next_block != NULL) set_prev(next_block, prev_block);
+    if (next_block != NULL) set_prev(a, next_block, prev_block);
+#if FIT_CACHE
+    fit_cache_drop(a, get_list_num(size), free_block);
+#endif
+
+#if TLSF
+    int bucket_num = get_list_num(size);
+    if (a->free_list[bucket_num] == NULL) {
+        int fl = bucket_num / SL_COUNT;
+        a->sl_bitmap[fl] &= ~(1U << (bucket_num % SL_COUNT));
+        if (a->sl_bitmap[fl] == 0) a->fl_bitmap &= ~(1UL << fl);
+    }
+#endif
+}
+
+static inline void remove_free_list(struct arena *a, void *free_block)
+{
+    unlink_free_list(a, free_block, get_hdr_size(free_block));
 }
 
 /* Seglist Function: update_bucket
  * ----------------------------------
  * Switches a free block from its current bucket if it belong to 
  * a diffrent bucket by removing it from the current bucket list and 
- * re-inserting it into the correct bucket. 
+ * re-inserting it into the correct bucket (otherwise just updating 
+ * its size among the bucket's candidates). A block in the size tree 
+ * is always re-inserted, since its key has changed. 
  */
-static inline void update_bucket(void *free_block, size_t old_size, size_t new_size)
+static inline void update_bucket(struct arena *a, void *free_block, size_t old_size, size_t new_size)
 {
-    if (get_bucket_num(old_size) != get_bucket_num(new_size)) {
-        remove_free_list(free_block);
-        insert_free_list(free_block);
+    bool rekey = false;
+#if SIZE_TREE
+    rekey = old_size >= TREE_MIN;
+#endif
+    if (rekey || get_list_num(old_size) != get_list_num(new_size)) {
+        unlink_free_list(a, free_block, old_size);
+        insert_free_list(a, free_block);
     }
+#if FIT_CACHE
+    else fit_cache_resize(a, get_list_num(new_size), free_block, new_size);
+#endif
 }
 
-/**** **** ****         Allocator Functions      **** **** ****/
+/**** **** ****         Segment Functions      **** **** ****/
 
 
-/* Function: myinit
- * ----------------
- * Initalizes the heap segment to INIT_NPAGES pages, resets the array 
- * values of the segregated list, and creates a single contiguous 
- * free block. Formats with an epilogue header and inserts the free block 
- * into the free list. 
+/* Segment Function: reserve_pages
+ * -------------------------------
+ * Reserves a segment for arena or slab pages as reserve_segment does, 
+ * aligned to at least GROW_SIZE. With HUGEPAGES the segment is also 
+ * advised to use huge pages. 
  */
-bool myinit()
+static bool reserve_pages(struct segment *seg, size_t len, size_t min_len, size_t align)
 {
-    // Initialize the Heap
-    int npages = INIT_NPAGES; 
-    heap_start = init_heap_segment(npages);
-    if (heap_start == NULL) return false;       //unable to allocated segment
+    if (!reserve_segment(seg, len, min_len, align > GROW_SIZE ? align : GROW_SIZE)) return false;
+#if HUGEPAGES
+    advise_huge_segment(seg);
+#endif
+    return true;
+}
 
-    // Reset Array Values of Segregated List
-    memset(free_list, 0, sizeof(void **) * NBUCKETS);
-    
-    // Create Single Contiguous Free Block
-    void* free_block = (char *)heap_start + ALIGNMENT; 
-    write_header(free_block, (npages * PAGE_SIZE) - ALIGNMENT - HDR_SIZE, FREE, ALLOC);
-    write_footer(free_block);
 
-    // Insert into the free list
-    insert_free_list(free_block);
+/**** **** ****         Slab Functions      **** **** ****/
 
-    // Create Epilogue Header
-    void *epilogue_hdr = get_next_block(free_block);
-    write_header(epilogue_hdr, 0 , ALLOC, FREE);
-    
-    return true;
-}
 
-/* Block Function: split_block
- * ---------------------
- * Updates the fields in block to split it into two parts: 
- * a malloc'd block and a free block with the corresponding sizes.
+/* Slab Function: is_slab
+ * ----------------------
+ * Returns true if the pointer is a slot in a slab page rather than 
+ * a block with a header. 
  */
-static inline void *split_block(void *block, size_t malloc_bytes, size_t free_bytes)
+static inline bool is_slab(void *ptr)
 {
-    /*// Set up the malloc'd block size and status
-    set_hdr_size(block, malloc_bytes);
-    set_curr_alloc(block, ALLOC);
+#if SLAB
+    return (uintptr_t)((char *)ptr - slab_seg.base) < SLAB_RESERVE;
+#else
+    return false;
+#endif
+}
 
-    // Write Free Block 
-    void *free_block = get_next_block(block);
-    write_header(free_block, free_bytes, FREE, ALLOC);
-    write_footer(free_block);
-    insert_free_list(free_block);*/
-    
-    // Write Free Block 
-    set_hdr_size(block, free_bytes);
-    set_curr_alloc(block, FREE);
-    write_footer(block);
-    insert_free_list(block);
+/* Slab Function: get_slab
+ * -----------------------
+ * Returns the header of the slab page that holds a slot. 
+ */
+static inline struct slab *get_slab(void *ptr)
+{
+    return (struct slab *)((uintptr_t)ptr & ~(uintptr_t)(PAGE_SIZE - 1));
+}
 
-    // Set up the malloc'd block size and status    
-    void *malloc_block = get_next_block(block);
-    write_header(malloc_block, malloc_bytes, ALLOC, FREE);
+/* Slab Function: get_slot_size
+ * -----------------------------
+ * Slot size of a class. Slots that could hold an object needing 
+ * ALIGNMENT are rounded up to a multiple of it, so that, packed from the
+ * aligned slab header, they are aligned like any other block. 
+ */
+static inline size_t get_slot_size(int cls)
+{
+    size_t size = (cls + 1) * SLAB_QUANTUM;
+    return size < ALIGNMENT ? size : roundup(size, ALIGNMENT);
+}
 
-    // Update Next Block
-    void *next_block = get_next_block(malloc_block);
-    set_prev_alloc(next_block, ALLOC);
+/* Mapped Function: is_mapped
+ * --------------------------
+ * Returns true if the pointer is a block with its own mapping. Slab 
+ * slots have no header to look at, so they are ruled out first. 
+ */
+static inline bool is_mapped(void *ptr)
+{
+    return !is_slab(ptr) && (get(get_hdr_addr(ptr)) & MAPPED) != 0;
+}
 
-    return malloc_block;
+/* Mapped Function: get_map_len
+ * ----------------------------
+ * Length of a mapped block's mapping. The header stores it in the 
+ * size field, so the MAPPED bit has to be masked back off. 
+ */
+static inline size_t get_map_len(void *bp)
+{
+    return get_hdr_size(bp) & ~(size_t)1;
 }
 
+/* Slab Function: get_usable_size
+ * ------------------------------
+ * Number of payload bytes behind any pointer handed out by mymalloc,
+ * whether it is a slab slot, a mapped block or a heap block. 
+ */
+static inline size_t get_usable_size(void *ptr)
+{
+    if (is_slab(ptr)) return get_slot_size(get_slab(ptr)->cls);
+    if (is_mapped(ptr)) return get_map_len(ptr) - ALIGNMENT;
+    return get_hdr_size(ptr);
+}
 
-/* Function: mymalloc 
- * ------------------
- * Attempts to search for the first free block with enough size. 
- * If unsuccessful, requests additional pages and formats as free block. 
- * Then decides to allocate the entire page or split the page (adding 
- * the appropriate epilogue header). Returns malloc'd block.  
+#if SLAB
+/* Slab Helper: reset_slabs
+ * ------------------------
+ * Reserves the slab range on first use and otherwise gives back every 
+ * slab page, since myinit has thrown away all slots. 
  */
-void *mymalloc(size_t requestedsz)
+static bool reset_slabs(void)
 {
-    if (requestedsz == 0) return NULL;  //ignore spurious requests
+    if (slab_seg.base == NULL && !reserve_pages(&slab_seg, SLAB_RESERVE, SLAB_RESERVE, PAGE_SIZE)) {
+        return false;
+    }
+    reset_segment(&slab_seg, 0);
+    slab_pages = NULL;
+    return true;
+}
 
-    // Find first block with correct size
-    size_t adjustedsz = adjust_block_size(requestedsz);
-    
-    // A/B Test whether to use first fit or best fit
-    void *block; 
-    if (BEST1_FIRST0 == 1) {
-        block = best_fit(adjustedsz);
+/* Slab Helper: new_slab
+ * ---------------------
+ * Takes a page from the slab range (reusing released pages first) and 
+ * formats it as an empty slab of the given class owned by the arena. 
+ */
+static struct slab *new_slab(struct arena *a, int cls)
+{
+    pthread_mutex_lock(&slab_lock);
+    struct slab *sl = slab_pages;
+    if (sl != NULL) {
+        slab_pages = sl->next;
     } else {
-        block = first_fit(adjustedsz);
+        sl = grow_segment(&slab_seg, 1);
     }
+    pthread_mutex_unlock(&slab_lock);
+    if (sl == NULL) return NULL;
 
-    // Request additional pages if no block found
-    if (block == NULL) { // Requests new page(s) and extends heap
-        int nbytes = roundup(adjustedsz, PAGE_SIZE);         //number of total bytes
+    sl->arena = a;
+    sl->cls = cls;
+    sl->nslots = (PAGE_SIZE - SLAB_HDR_SZ) / get_slot_size(cls);
+    sl->nfree = sl->nslots;
 
-        // Attempt to Extend Heap
-        block = extend_heap_segment(nbytes / PAGE_SIZE);
-        if (block == NULL) return NULL;
+    // Mark exactly nslots slots free
+    int nbits = 8 * sizeof(unsigned long);
+    for (int w = 0; w < SLAB_BITMAP_WORDS; w++) {
+        int nset = sl->nslots - w * nbits;
+        if (nset >= nbits)  sl->bitmap[w] = ~0UL;
+        else if (nset > 0)  sl->bitmap[w] = (1UL << nset) - 1;
+        else                sl->bitmap[w] = 0;
+    }
+    return sl;
+}
 
-        // Format new page as a free block
-        if (get_prev_alloc(block) == FREE) {
-            // Merge with previous block
-            void* prev_block = get_prev_block(block);
-            size_t prev_size = get_hdr_size(prev_block); 
-            size_t totalsz = prev_size + nbytes; 
-            set_hdr_size(prev_block, totalsz);
+/* Slab Helper: push_slab, unlink_slab
+ * -----------------------------------
+ * Add or remove a slab on its arena's list of slabs with free slots. 
+ */
+static inline void push_slab(struct arena *a, struct slab *sl)
+{
+    sl->prev = NULL;
+    sl->next = a->slabs[sl->cls];
+    if (sl->next != NULL) sl->next->prev = sl;
+    a->slabs[sl->cls] = sl;
+}
+
+static inline void unlink_slab(struct arena *a, struct slab *sl)
+{
+    if (sl->prev != NULL) sl->prev->next = sl->next;
+    else                  a->slabs[sl->cls] = sl->next;
+    if (sl->next != NULL) sl->next->prev = sl->prev;
+}
+
+/* Slab Function: slab_malloc
+ * --------------------------
+ * Hands out the lowest free slot of the first slab of the class with 
+ * room, starting a new slab if there is none. Returns NULL once the 
+ * slab range is used up. Caller must hold the arena's lock. 
+ */
+static void *slab_malloc(struct arena *a, int cls)
+{
+    struct slab *sl = a->slabs[cls];
+    if (sl == NULL) {
+        sl = new_slab(a, cls);
+        if (sl == NULL) return NULL;
+        push_slab(a, sl);
+    }
+
+    int w = 0;
+    while (sl->bitmap[w] == 0) w++;
+    int bit = __builtin_ctzl(sl->bitmap[w]);
+    sl->bitmap[w] &= ~(1UL << bit);
+    if (--sl->nfree == 0) unlink_slab(a, sl);    //full slabs leave the list
+
+    int slot = w * 8 * sizeof(unsigned long) + bit;
+    return (char *)sl + SLAB_HDR_SZ + slot * get_slot_size(cls);
+}
+
+/* Slab Function: slab_free
+ * ------------------------
+ * Marks a slot free. A slab that was full rejoins the list; a slab 
+ * that becomes empty goes back to the page pool unless it is the only
+ * slab of its class left. Caller must hold the arena's lock. 
+ */
+static void slab_free(struct arena *a, void *ptr)
+{
+    struct slab *sl = get_slab(ptr);
+    int slot = ((char *)ptr - (char *)sl - SLAB_HDR_SZ) / get_slot_size(sl->cls);
+    int nbits = 8 * sizeof(unsigned long);
+    sl->bitmap[slot / nbits] |= 1UL << (slot % nbits);
+
+    if (++sl->nfree == 1) push_slab(a, sl);
+    if (sl->nfree == sl->nslots && (sl->next != NULL || sl->prev != NULL)) {
+        unlink_slab(a, sl);
+        pthread_mutex_lock(&slab_lock);
+        sl->next = slab_pages;
+        slab_pages = sl;
+        pthread_mutex_unlock(&slab_lock);
+    }
+}
+#endif
+
+/**** **** ****         Mapped Block Functions      **** **** ****/
+
+
+/* Mapped Helper: write_map_header
+ * -------------------------------
+ * A mapped block starts ALIGNMENT bytes into its mapping. Its header 
+ * holds the mapping length, the MAPPED bit, and both alloc bits set so
+ * that nothing ever treats it as free. 
+ */
+static inline void *write_map_header(char *base, size_t maplen)
+{
+    void *bp = base + ALIGNMENT;
+    *(size_t *)get_hdr_addr(bp) = (maplen << 2) | MAPPED | (ALLOC << 1) | ALLOC;
+    return bp;
+}
+
+/* Mapped Function: mmap_malloc
+ * ----------------------------
+ * Gives a large request its own anonymous mapping. Returns NULL if the
+ * kernel refuses. 
+ */
+static void *mmap_malloc(size_t requestedsz)
+{
+    size_t maplen = roundup(requestedsz + ALIGNMENT, PAGE_SIZE);
+    char *base = mmap(NULL, maplen, PROT_READ | PROT_WRITE, 
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) return NULL;
+    __atomic_add_fetch(&mapped_bytes, maplen, __ATOMIC_RELAXED);
+    return write_map_header(base, maplen);
+}
+
+/* Mapped Function: mmap_free
+ * --------------------------
+ * Hands a mapped block straight back to the OS. 
+ */
+static void mmap_free(void *bp)
+{
+    size_t maplen = get_map_len(bp);
+    __atomic_sub_fetch(&mapped_bytes, maplen, __ATOMIC_RELAXED);
+    munmap((char *)bp - ALIGNMENT, maplen);
+}
+
+/* Mapped Function: mmap_realloc
+ * -----------------------------
+ * Grows or shrinks a mapped block with mremap, which moves pages 
+ * rather than copying bytes when the mapping cannot stay in place 
+ * (unless may_move is false, in which case that fails). 
+ */
+static void *mmap_realloc(void *bp, size_t newsz, bool may_move)
+{
+    size_t oldlen = get_map_len(bp);
+    size_t newlen = roundup(newsz + ALIGNMENT, PAGE_SIZE);
+    if (newlen == oldlen) return bp;
+
+    char *base = mremap((char *)bp - ALIGNMENT, oldlen, newlen, may_move ? MREMAP_MAYMOVE : 0);
+    if (base == MAP_FAILED) return NULL;
+    __atomic_add_fetch(&mapped_bytes, newlen - oldlen, __ATOMIC_RELAXED);
+    return write_map_header(base, newlen);
+}
+
+/**** **** ****         Arena Functions      **** **** ****/
+
+
+static __thread struct arena *thread_arena;     //arena this thread allocates from
+static __thread unsigned int thread_gen;        //heap_gen thread_arena was picked under
+static pthread_key_t thread_key;
+static pthread_once_t thread_once = PTHREAD_ONCE_INIT;
+static void thread_exit(void *arg);
+static inline void arena_lock(struct arena *a);
+#if TCACHE
+static bool tcache_holds(bool slots);
+static void tcache_release(bool slots);
+#endif
+
+/* Arena Helper: format_segment
+ * ----------------------------
+ * Formats the pages handed out so far in a fresh segment of arena a: 
+ * the word naming the arena, then a single free block, which goes on 
+ * the free lists, then an epilogue header. The block's prev_alloc bit 
+ * is set, so nothing coalesces past the start of a segment. Returns the
+ * free block. 
+ */
+static void *format_segment(struct arena *a, struct segment *seg)
+{
+    *(struct arena **)seg->base = a;
+
+    // Create Single Contiguous Free Block
+    void* free_block = seg->base + FIRST_BLOCK; 
+    write_header(free_block, seg->size - FIRST_BLOCK - HDR_SIZE, FREE, ALLOC);
+    write_footer(free_block);
+    set_zero_from(free_block, ZERO_MIN);    //fresh pages
+
+    // Insert into the free list
+    insert_free_list(a, free_block);
+
+    // Create Epilogue Header
+    void *epilogue_hdr = get_next_block(free_block);
+    write_header(epilogue_hdr, 0 , ALLOC, FREE);
+    return free_block;
+}
+
+/* Arena Helper: format_arena
+ * --------------------------
+ * Resets the segregated lists of an arena, hands back its overflow 
+ * segments, and starts its first segment (already reserved) over with 
+ * npages pages formatted as a single free block. Returns false if they
+ * do not fit. 
+ */
+static bool format_arena(struct arena *a, int npages)
+{
+    // Reset Array Values of Segregated List
+    memset(a->free_list, 0, sizeof(void **) * NLISTS);
+#if SIZE_TREE
+    a->size_tree = NULL;
+#endif
+#if TLSF
+    a->fl_bitmap = 0;
+    memset(a->sl_bitmap, 0, sizeof(a->sl_bitmap));
+#endif
+#if FIT_CACHE
+    memset(a->fit_size, 0, sizeof(a->fit_size));
+    memset(a->fit_blk, 0, sizeof(a->fit_blk));
+    memset(a->fit_head, 0, sizeof(a->fit_head));
+    memset(a->fit_count, 0, sizeof(a->fit_count));
+#endif
+    memset(a->slabs, 0, sizeof(a->slabs));
+#if QUICKLIST
+    memset(a->quick, 0, sizeof(a->quick));
+    memset(a->quick_count, 0, sizeof(a->quick_count));
+    a->quick_total = 0;
+#endif
+    a->dirty_since = 0;
+
+    while (a->nsegs > 1) release_segment(&a->segs[--a->nsegs]);
+    if (reset_segment(&a->segs[0], npages) == NULL) return false;
+    a->nsegs = 1;
+    format_segment(a, &a->segs[0]);
+    return true;
+}
+
+/* Arena Helper: init_secondary_arena
+ * ----------------------------------
+ * Sets up an arena other than arena 0. The first time, reserves an 
+ * ARENA_RESERVE-aligned segment (pages are only committed as the arena
+ * grows); later calls discard the old contents and reformat in place. 
+ */
+static bool init_secondary_arena(struct arena *a)
+{
+    if (a->segs[0].base == NULL && 
+        !reserve_pages(&a->segs[0], ARENA_RESERVE, ARENA_RESERVE, ARENA_RESERVE)) {
+        return false;
+    }
+    return format_arena(a, START_NPAGES);
+}
+
+/* Arena Helper: extend_arena
+ * --------------------------
+ * Adds npages pages to the end of an arena's last segment and returns 
+ * the address of the first new page (NULL if the segment is full, or 
+ * with COMPACT_LINKS would outgrow what a link can reach). 
+ */
+static void *extend_arena(struct arena *a, size_t npages)
+{
+    struct segment *seg = &a->segs[a->nsegs - 1];
+#if COMPACT_LINKS
+    if (seg->size + npages * PAGE_SIZE > LINK_REACH) return NULL;
+#endif
+    void *block = grow_segment(seg, npages);
+    if (block != NULL) STAT_ADD(a, extend_calls, 1);
+    return block;
+}
+
+/* Arena Helper: add_segment
+ * -------------------------
+ * Gives an arena whose last segment is full a new ARENA_RESERVE-aligned
+ * segment, with room for a block of adjustedsz bytes and formatted like
+ * the first, so that growth does not depend on the address space right
+ * after the old one. Returns its free block, or NULL if the arena has 
+ * NSEGMENTS segments already or no address space is left. 
+ */
+static void *add_segment(struct arena *a, size_t adjustedsz)
+{
+    if (a->nsegs == NSEGMENTS) return NULL;
+    struct segment *seg = &a->segs[a->nsegs];
+    size_t npages = roundup(FIRST_BLOCK + adjustedsz + HDR_SIZE, GROW_SIZE) / PAGE_SIZE;
+    if (npages < START_NPAGES) npages = START_NPAGES;
+    if (!reserve_pages(seg, ARENA_RESERVE, ARENA_RESERVE, ARENA_RESERVE)) return NULL;
+    if (grow_segment(seg, npages) == NULL) {
+        release_segment(seg);
+        return NULL;
+    }
+    __atomic_store_n(&a->nsegs, a->nsegs + 1, __ATOMIC_RELEASE);
+    STAT_ADD(a, extend_calls, 1);
+    return format_segment(a, seg);
+}
+
+/* Arena Function: arena_of
+ * ------------------------
+ * Finds the arena that owns a block in O(1). Slab slots name their 
+ * arena in the page header. Arena 0's first segment is recognized by 
+ * its address range; any other block lies in an aligned segment whose 
+ * first word points back at its arena. 
+ */
+static inline struct arena *arena_of(void *bp)
+{
+    if (is_slab(bp)) return get_slab(bp)->arena;
+    char *main_start = arenas[0].segs[0].base;
+    char *main_end = main_start + __atomic_load_n(&arenas[0].segs[0].size, __ATOMIC_ACQUIRE);
+    if ((char *)bp > main_start && (char *)bp < main_end) return &arenas[0];
+    return *(struct arena **)((uintptr_t)bp & ~(uintptr_t)(ARENA_RESERVE - 1));
+}
+
+static void make_thread_key(void)
+{
+    pthread_key_create(&thread_key, thread_exit);
+}
+
+/* Arena Helper: attach_arena
+ * --------------------------
+ * Attaches the calling thread to the least loaded arena (fewest attached 
+ * threads, lowest index on ties, so a single-threaded client only ever 
+ * uses arena 0), setting it up on first use. Falls back to arena 0 if 
+ * a new arena cannot be reserved. 
+ */
+static struct arena *attach_arena(void)
+{
+    pthread_once(&thread_once, make_thread_key);
+    pthread_mutex_lock(&arena_attach_lock);
+    struct arena *a = &arenas[0];
+    for (int i = 1; i < NARENAS; i++) {
+        if (arenas[i].nthreads < a->nthreads) a = &arenas[i];
+    }
+    if (a->segs[0].base == NULL && !init_secondary_arena(a)) a = &arenas[0];
+    __atomic_fetch_add(&a->nthreads, 1, __ATOMIC_RELAXED);     //read unlocked by is_remote
+    pthread_mutex_unlock(&arena_attach_lock);
+
+    thread_arena = a;
+    thread_gen = heap_gen;
+    pthread_setspecific(thread_key, a);
+    return a;
+}
+
+/* Arena Function: get_arena
+ * -------------------------
+ * Returns the arena the calling thread allocates from. 
+ */
+static inline struct arena *get_arena(void)
+{
+    if (thread_arena == NULL || thread_gen != heap_gen) return attach_arena();
+    return thread_arena;
+}
+
+/**** **** ****         Quick List Functions      **** **** ****/
+
+
+#if QUICKLIST
+static inline void *coalesce(struct arena *a, void *curr_block);
+
+/* Quick Helper: quick_flush
+ * -------------------------
+ * Keeps the keep most recently freed blocks of a quick list and 
+ * coalesces the rest into the free lists. Caller must hold the lock. 
+ */
+static void quick_flush(struct arena *a, int idx, int keep)
+{
+    void **link = &a->quick[idx];
+    for (int i = 0; i < keep && *link != NULL; i++) link = (void **)*link;
+
+    void *curr = *link;
+    *link = NULL;
+    while (curr != NULL) {
+        void *next = get_stack_next(curr);
+        coalesce(a, curr);
+        a->quick_count[idx]--;
+        a->quick_total--;
+        curr = next;
+    }
+}
+
+/* Quick Function: quick_consolidate
+ * ---------------------------------
+ * Coalesces every block held in the arena's quick lists. Caller must 
+ * hold the lock. 
+ */
+static void quick_consolidate(struct arena *a)
+{
+    for (int i = 0; i < QUICK_NCLASSES && a->quick_total > 0; i++) {
+        if (a->quick[i] != NULL) quick_flush(a, i, 0);
+    }
+    STAT_ADD(a, consolidations, 1);
+}
+
+/* Quick Function: quick_get, quick_put
+ * ------------------------------------
+ * Pop a block of exactly adjustedsz bytes, or push a freed block, on 
+ * the arena's quick lists. quick_get returns NULL on a miss, quick_put 
+ * returns false if the block is not of a quick size. Caller must hold
+ * the lock. 
+ */
+static inline void *quick_get(struct arena *a, size_t adjustedsz)
+{
+    size_t idx = (adjustedsz - MIN_BLK_SZ) >> ALIGN_LOG2;
+    if (idx >= QUICK_NCLASSES || a->quick[idx] == NULL) return NULL;
+
+    void *block = a->quick[idx];
+    a->quick[idx] = get_stack_next(block);
+    a->quick_count[idx]--;
+    a->quick_total--;
+    STAT_ADD(a, quick_hits, 1);
+    return block;
+}
+
+static inline bool quick_put(struct arena *a, void *block)
+{
+    size_t idx = (get_hdr_size(block) - MIN_BLK_SZ) >> ALIGN_LOG2;
+    if (idx >= QUICK_NCLASSES) return false;
+
+    set_stack_next(block, a->quick[idx]);
+    a->quick[idx] = block;
+    a->quick_total++;
+    if (++a->quick_count[idx] == QUICK_COUNT) quick_flush(a, idx, QUICK_COUNT / 2);
+    return true;
+}
+#endif
+
+/**** **** ****         Scavenging Functions      **** **** ****/
+
+
+static pthread_t scavenger;
+static bool scavenger_running;
+static pthread_mutex_t scavenger_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t scavenger_wake = PTHREAD_COND_INITIALIZER;
+
+/* Scavenge Helper: now_ms
+ * -----------------------
+ * Coarse monotonic clock in milliseconds (a vDSO read, no syscall). 
+ */
+static inline unsigned long now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+}
+
+/* Scavenge Function: release_block
+ * --------------------------------
+ * Releases the whole pages (huge pages with HUGEPAGES) inside a free 
+ * block, keeping the pages that hold its header, links and footer. The
+ * word before the footer records the size the block had when released,
+ * so that a block is skipped until coalescing or splitting changes it. 
+ * The part page below the mark is cleared too, so everything from the 
+ * first released page on is zero. 
+ */
+static void release_block(void *bp)
+{
+    size_t size = get_hdr_size(bp);
+    size_t *mark = (size_t *)((char *)get_ftr_addr(bp) - sizeof(size_t));
+    if (*mark == size) return;      //already released at this size
+
+    char *lo = (char *)roundup((uintptr_t)bp + ZERO_MIN, GROW_SIZE);
+    char *hi = (char *)((uintptr_t)mark & ~(uintptr_t)(GROW_SIZE - 1));
+    if (hi > lo) {
+        madvise(lo, hi - lo, MADV_DONTNEED);
+        memset(hi, 0, (char *)mark - hi);
+        size_t zero_from = get_zero_from(bp);
+        if (zero_from == 0 || zero_from > (size_t)(lo - (char *)bp)) set_zero_from(bp, lo - (char *)bp);
+    }
+    *mark = size;
+}
+
+/* Scavenge Function: clear_release_mark
+ * -------------------------------------
+ * Clears the release mark of a free block being allocated from. The 
+ * caller may dirty its pages, and a block freed again at the same size
+ * and place would otherwise look released already. Its links must no 
+ * longer be needed, since in a minimum-size block the mark is one. 
+ */
+static inline void clear_release_mark(void *bp)
+{
+    *(size_t *)((char *)get_ftr_addr(bp) - sizeof(size_t)) = 0;
+}
+
+#if SIZE_TREE
+/* Scavenge Helper: release_subtree
+ * --------------------------------
+ * Releases every block of at least SCAVENGE_MIN bytes in a subtree of 
+ * the size tree, skipping left subtrees below that size. 
+ */
+static void release_subtree(void *node)
+{
+    for (; node != NULL; node = *tree_right(node)) {
+        if (get_hdr_size(node) >= SCAVENGE_MIN) {
+            release_block(node);
+            release_subtree(*tree_left(node));
+        }
+    }
+}
+#endif
+
+/* Scavenge Function: scavenge_arena
+ * ---------------------------------
+ * Releases every free block of at least SCAVENGE_MIN bytes in an 
+ * arena. Caller must hold the arena's lock. 
+ */
+static void scavenge_arena(struct arena *a)
+{
+#if QUICKLIST
+    if (a->quick_total > 0) quick_consolidate(a);
+#endif
+    for (int i = get_list_num(SCAVENGE_MIN); i < NLISTS; i++) {
+        for (void *curr = a->free_list[i]; curr != NULL; curr = get_next(a, curr)) {
+            if (get_hdr_size(curr) >= SCAVENGE_MIN) release_block(curr);
+        }
+    }
+#if SIZE_TREE
+    release_subtree(a->size_tree);
+#endif
+    a->dirty_since = 0;
+}
+
+/* Scavenge Function: scavenge_on_free
+ * -----------------------------------
+ * Decay policy applied to each block coalesced on free. A large tail 
+ * block is trimmed right away. Any other large block starts the arena's
+ * decay clock, and the first large free after DECAY_MS have passed 
+ * scavenges the whole arena. Caller must hold the arena's lock. 
+ */
+static inline void scavenge_on_free(struct arena *a, void *block)
+{
+    size_t size = get_hdr_size(block);
+    if (size < SCAVENGE_MIN) return;
+
+    if (size >= TRIM_THRESHOLD && get_hdr_size(get_next_block(block)) == 0) {
+        release_block(block);           //tail block before the epilogue
+        return;
+    }
+    unsigned long now = now_ms();
+    if (a->dirty_since == 0) {
+        a->dirty_since = now;
+    } else if (now - a->dirty_since >= DECAY_MS) {
+        scavenge_arena(a);
+    }
+}
+
+/* Scavenge Helper: scavenger_main
+ * -------------------------------
+ * Body of the optional scavenger thread. Every interval, frees the 
+ * remote frees queued on each arena and scavenges those whose decay 
+ * clock has run out, so that idle processes release memory without 
+ * waiting for another malloc or free. 
+ */
+static void *scavenger_main(void *arg)
+{
+    unsigned int interval_ms = (uintptr_t)arg;
+    pthread_mutex_lock(&scavenger_lock);
+    while (scavenger_running) {
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec += interval_ms / 1000;
+        until.tv_nsec += (interval_ms % 1000) * 1000000L;
+        if (until.tv_nsec >= 1000000000L) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&scavenger_wake, &scavenger_lock, &until);
+        if (!scavenger_running) break;
+
+        for (int i = 0; i < NARENAS; i++) {
+            struct arena *a = &arenas[i];
+            if (a->segs[0].base == NULL) continue;
+            arena_lock(a);      //remote frees may be all that is left to free
+            if (a->dirty_since != 0 && now_ms() - a->dirty_since >= DECAY_MS) {
+                scavenge_arena(a);
+            }
+            pthread_mutex_unlock(&a->lock);
+        }
+    }
+    pthread_mutex_unlock(&scavenger_lock);
+    return NULL;
+}
+
+/**** **** ****         Profiling Functions      **** **** ****/
+
+
+#if PROFILE
+#define PROFILE_IDLE_BYTES  (1L << 20)  //countdown while stopped, to notice a start
+#define PROFILE_FILTER_BITS 16          //log2 of the counters in profile_filter
+
+/* A call stack the profiler has sampled: its return addresses and the 
+ * sampled blocks allocated from it, in total and still in use. 
+ */
+struct profile_stack {
+    uint64_t hash;                  //0 if the slot is empty
+    int depth;
+    size_t alloc_count, alloc_bytes;
+    size_t inuse_count, inuse_bytes;
+    void *pc[PROFILE_DEPTH];
+};
+
+/* A sampled block still allocated, keyed by its address. */
+struct profile_live {
+    void *ptr;                      //NULL if the slot is empty
+    size_t size;                    //bytes requested
+    uint32_t stack;                 //slot in profile_stacks
+};
+
+static size_t profile_rate;         //mean bytes between samples (0 while stopped)
+static size_t profile_period;       //rate of the samples held (0 if never started)
+static size_t profile_nlive;        //entries in profile_live (read without the lock)
+static size_t profile_nstacks;      //entries in profile_stacks
+static struct profile_stack *profile_stacks;    //PROFILE_STACKS slots, mapped on first start
+static struct profile_live *profile_live;       //PROFILE_LIVE slots, mapped on first start
+static unsigned char profile_filter[1 << PROFILE_FILTER_BITS];  //live samples per address hash
+static pthread_mutex_t profile_lock = PTHREAD_MUTEX_INITIALIZER;    //guards everything above
+static char profile_prefix[256];    //file name prefix of signalled dumps (under the lock)
+static sem_t profile_sem;           //posted by the dump signal
+static bool profile_dumper_running;
+
+static __thread long profile_left;  //bytes this thread allocates before its next sample
+static __thread size_t profile_thread_rate; //rate profile_left was drawn at (0 for idle)
+static __thread uint64_t profile_rng;
+static __thread bool profile_busy;  //taking a sample, whose backtrace may allocate
+
+/* Profile Helper: profile_hash
+ * ----------------------------
+ * Hashes a block address down to bits bits. 
+ */
+static inline size_t profile_hash(void *ptr, int bits)
+{
+    return (size_t)((((uint64_t)(uintptr_t)ptr >> 4) * 0x9E3779B97F4A7C15ULL) >> (64 - bits));
+}
+
+/* Profile Helper: profile_log
+ * ---------------------------
+ * Natural logarithm of x > 0, to within about 1e-5, without libm: 
+ * x = m * 2^e with m in [1, 2), and ln m = 2 atanh((m - 1) / (m + 1)) 
+ * by its series, which converges quickly since the ratio is below 1/3. 
+ */
+static double profile_log(double x)
+{
+    uint64_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    int e = (int)((bits >> 52) & 0x7ff) - 1023;
+    bits = (bits & ((1ULL << 52) - 1)) | (1023ULL << 52);
+    double m;
+    memcpy(&m, &bits, sizeof(m));
+    double s = (m - 1) / (m + 1), s2 = s * s;
+    return e * 0.6931471805599453 + 2 * s * (1 + s2 * (1.0 / 3 + s2 * (1.0 / 5 + s2 / 7)));
+}
+
+/* Profile Helper: profile_interval
+ * --------------------------------
+ * Draws the bytes until this thread's next sample from an exponential 
+ * distribution with mean rate, so that samples form a Poisson process 
+ * over the bytes allocated and each allocation is sampled with 
+ * probability 1 - exp(-size / rate), which pprof undoes when scaling. 
+ */
+static long profile_interval(size_t rate)
+{
+    uint64_t x = profile_rng;
+    if (x == 0) x = ((uint64_t)(uintptr_t)&profile_rng ^ now_ms()) * 0x9E3779B97F4A7C15ULL | 1;
+    x ^= x >> 12;   //xorshift64*
+    x ^= x << 25;
+    x ^= x >> 27;
+    profile_rng = x;
+    double u = (double)(((x * 0x2545F4914F6CDD1DULL) >> 11) + 1) / (1ULL << 53);    //in (0, 1]
+    return (long)(-profile_log(u) * rate) + 1;
+}
+
+/* Profile Helper: profile_find_live
+ * ---------------------------------
+ * Slot of ptr in the open-addressed table of live samples, or of the 
+ * empty slot that ends its probe sequence. Caller must hold the lock. 
+ */
+static size_t profile_find_live(void *ptr)
+{
+    size_t i = profile_hash(ptr, 31) & (PROFILE_LIVE - 1);
+    while (profile_live[i].ptr != NULL && profile_live[i].ptr != ptr) i = (i + 1) & (PROFILE_LIVE - 1);
+    return i;
+}
+
+/* Profile Helper: profile_add_live, profile_remove_live
+ * -----------------------------------------------------
+ * Enter a sampled block into the live table and take it out again, 
+ * counting it in the address filter that myfree consults first. Removal
+ * shifts later entries of the probe sequence back so that no tombstones 
+ * are needed. A filter counter that saturates stays set for good. 
+ * Caller must hold the lock. 
+ */
+static void profile_add_live(void *ptr, size_t size, uint32_t stack)
+{
+    size_t i = profile_find_live(ptr);
+    profile_live[i] = (struct profile_live){ .ptr = ptr, .size = size, .stack = stack };
+    unsigned char *count = &profile_filter[profile_hash(ptr, PROFILE_FILTER_BITS)];
+    if (*count < UCHAR_MAX) __atomic_store_n(count, *count + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&profile_nlive, profile_nlive + 1, __ATOMIC_RELAXED);
+}
+
+static void profile_remove_live(size_t i)
+{
+    unsigned char *count = &profile_filter[profile_hash(profile_live[i].ptr, PROFILE_FILTER_BITS)];
+    if (*count < UCHAR_MAX) __atomic_store_n(count, *count - 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&profile_nlive, profile_nlive - 1, __ATOMIC_RELAXED);
+
+    size_t hole = i;
+    for (size_t j = (i + 1) & (PROFILE_LIVE - 1); profile_live[j].ptr != NULL; j = (j + 1) & (PROFILE_LIVE - 1)) {
+        // An entry may fill the hole if its home slot is not in (hole, j]
+        size_t home = profile_hash(profile_live[j].ptr, 31) & (PROFILE_LIVE - 1);
+        if (((j - home) & (PROFILE_LIVE - 1)) >= ((j - hole) & (PROFILE_LIVE - 1))) {
+            profile_live[hole] = profile_live[j];
+            hole = j;
+        }
+    }
+    profile_live[hole].ptr = NULL;
+}
+
+/* Profile Helper: profile_find_stack
+ * ----------------------------------
+ * Slot of the stack pc[0..depth) in the stack table, entering it if it 
+ * is new. Returns -1 if the table is too full to take another stack. 
+ * Caller must hold the lock. 
+ */
+static long profile_find_stack(void **pc, int depth)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL ^ depth;     //FNV-1a over the addresses
+    for (int i = 0; i < depth; i++) hash = (hash ^ (uintptr_t)pc[i]) * 0x100000001b3ULL;
+    hash |= 1;
+
+    size_t i = hash & (PROFILE_STACKS - 1);
+    for (; profile_stacks[i].hash != 0; i = (i + 1) & (PROFILE_STACKS - 1)) {
+        struct profile_stack *s = &profile_stacks[i];
+        if (s->hash == hash && s->depth == depth && memcmp(s->pc, pc, depth * sizeof(void *)) == 0) return i;
+    }
+    if (profile_nstacks >= PROFILE_STACKS * 3 / 4) return -1;
+    profile_nstacks++;
+    profile_stacks[i].hash = hash;
+    profile_stacks[i].depth = depth;
+    memcpy(profile_stacks[i].pc, pc, depth * sizeof(void *));
+    return i;
+}
+
+/* Profile Function: profile_sample
+ * --------------------------------
+ * Runs when the calling thread's countdown to its next sample runs out 
+ * on the allocation of ptr (size bytes requested). Draws a new countdown,
+ * and unless the countdown was drawn at another rate (or while stopped),
+ * records ptr with the stack that allocated it. The backtrace is taken 
+ * before locking, since its first use may load the unwinder and allocate.
+ * Samples that do not fit in the tables are dropped. 
+ */
+static __attribute__((noinline)) void profile_sample(void *ptr, size_t size)
+{
+    size_t rate = __atomic_load_n(&profile_rate, __ATOMIC_RELAXED);
+    bool armed = rate != 0 && rate == profile_thread_rate && !profile_busy;
+    profile_thread_rate = rate;
+    profile_left = rate == 0 ? PROFILE_IDLE_BYTES : profile_interval(rate);
+    if (!armed) return;
+
+    profile_busy = true;
+    void *pc[PROFILE_DEPTH + 1];
+    int depth = backtrace(pc, PROFILE_DEPTH + 1) - 1;   //drop this frame
+    pthread_mutex_lock(&profile_lock);
+    if (profile_rate == rate && profile_nlive < PROFILE_LIVE * 3 / 4) {
+        long stack = profile_find_stack(pc + 1, depth);
+        if (stack >= 0) {
+            struct profile_stack *s = &profile_stacks[stack];
+            s->alloc_count++;
+            s->alloc_bytes += size;
+            s->inuse_count++;
+            s->inuse_bytes += size;
+            profile_add_live(ptr, size, stack);
+        }
+    }
+    pthread_mutex_unlock(&profile_lock);
+    profile_busy = false;
+}
+
+/* Profile Function: profile_forget
+ * --------------------------------
+ * Takes ptr out of the live samples if it is one, and, if moved_to is 
+ * not NULL, enters it again at that address (for a realloc that moved 
+ * it). The filter rules out most blocks without locking. 
+ */
+static __attribute__((noinline)) void profile_forget(void *ptr, void *moved_to)
+{
+    if (__atomic_load_n(&profile_filter[profile_hash(ptr, PROFILE_FILTER_BITS)], __ATOMIC_RELAXED) == 0) return;
+    pthread_mutex_lock(&profile_lock);
+    size_t i = profile_find_live(ptr);
+    if (profile_live[i].ptr != NULL) {
+        struct profile_live entry = profile_live[i];
+        profile_remove_live(i);
+        if (moved_to != NULL) {
+            profile_add_live(moved_to, entry.size, entry.stack);
+        } else {
+            profile_stacks[entry.stack].inuse_count--;
+            profile_stacks[entry.stack].inuse_bytes -= entry.size;
+        }
+    }
+    pthread_mutex_unlock(&profile_lock);
+}
+
+/* Profile Function: profile_clear_live
+ * ------------------------------------
+ * Forgets every live sample, as myinit does when it wipes the heap. 
+ * With clear_stacks, forgets the stacks and their totals as well. 
+ * Caller must hold the lock. 
+ */
+static void profile_clear_live(bool clear_stacks)
+{
+    if (profile_live == NULL) return;
+    madvise(profile_live, PROFILE_LIVE * sizeof(struct profile_live), MADV_DONTNEED);   //back to zero pages
+    memset(profile_filter, 0, sizeof(profile_filter));
+    __atomic_store_n(&profile_nlive, 0, __ATOMIC_RELAXED);
+    if (clear_stacks) {
+        madvise(profile_stacks, PROFILE_STACKS * sizeof(struct profile_stack), MADV_DONTNEED);
+        profile_nstacks = 0;
+    } else {
+        for (size_t i = 0; i < PROFILE_STACKS; i++) {
+            profile_stacks[i].inuse_count = profile_stacks[i].inuse_bytes = 0;
+        }
+    }
+}
+
+/* Profile Function: profile_dumper_main
+ * -------------------------------------
+ * Body of the thread that writes a profile each time the dump signal 
+ * arrives, to PREFIX.PID.SEQ.heap. The handler only posts profile_sem, 
+ * since nothing else it could do is async-signal-safe. 
+ */
+static void *profile_dumper_main(void *arg)
+{
+    (void)arg;
+    for (unsigned int seq = 1;; seq++) {
+        while (sem_wait(&profile_sem) != 0) continue;   //EINTR
+        char path[sizeof(profile_prefix) + 32];
+        pthread_mutex_lock(&profile_lock);
+        snprintf(path, sizeof(path), "%s.%d.%04u.heap", profile_prefix, (int)getpid(), seq);
+        pthread_mutex_unlock(&profile_lock);
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) continue;
+        myprofile_dump(fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+static void profile_on_signal(int signo)
+{
+    (void)signo;
+    int saved_errno = errno;
+    sem_post(&profile_sem);
+    errno = saved_errno;
+}
+#endif
+
+/* Function: profile_malloc, profile_free, profile_move
+ * ----------------------------------------------------
+ * Hooks the public functions call on every block they hand out, free, or
+ * move in a realloc. While the profiler is stopped, malloc only counts 
+ * down (re-checking once every PROFILE_IDLE_BYTES), and free only checks
+ * that no sample is live. 
+ */
+static inline void profile_malloc(void *ptr, size_t size)
+{
+#if PROFILE
+    if (__builtin_expect((profile_left -= size) < 0, 0)) profile_sample(ptr, size);
+#endif
+}
+
+static inline void profile_free(void *ptr)
+{
+#if PROFILE
+    if (__builtin_expect(__atomic_load_n(&profile_nlive, __ATOMIC_RELAXED) != 0, 0)) profile_forget(ptr, NULL);
+#endif
+}
+
+static inline void profile_move(void *oldptr, void *newptr)
+{
+#if PROFILE
+    if (newptr != oldptr && __atomic_load_n(&profile_nlive, __ATOMIC_RELAXED) != 0) profile_forget(oldptr, newptr);
+#endif
+}
+
+/**** **** ****         Allocator Functions      **** **** ****/
+
+
+/* Function: myinit
+ * ----------------
+ * Initalizes arena 0's first segment to START_NPAGES pages (releasing 
+ * any overflow segments), resets the array values of the segregated 
+ * list, and creates a single contiguous free block. Formats with an 
+ * epilogue header and inserts the free block into the free list. Any 
+ * other arenas already in use are wiped the same way, as are all slab 
+ * pages. Blocks still sitting in thread caches belong to the old heap,
+ * so bumping heap_gen makes each thread drop its cache and re-pick an 
+ * arena. 
+ * NOTE: Not thread-safe; no other thread may be using the heap. 
+ */
+bool myinit()
+{
+    // Initialize the Heap
+    int npages = START_NPAGES; 
+    struct segment *seg = &arenas[0].segs[0];
+    if (seg->base == NULL && !reserve_pages(seg, SEGMENT_RESERVE, npages * PAGE_SIZE, PAGE_SIZE)) {
+        return false;       //unable to reserve segment
+    }
+    if (!format_arena(&arenas[0], npages)) return false;
+#if SLAB
+    if (!reset_slabs()) return false;
+#endif
+
+    for (int i = 0; i < NARENAS; i++) {
+        if (i > 0 && arenas[i].segs[0].base != NULL) init_secondary_arena(&arenas[i]);
+        arenas[i].nthreads = 0;
+#if REMOTE_FREE
+        arenas[i].remote = NULL;
+#endif
+#if STATS
+        memset(&arenas[i].stats, 0, sizeof(arenas[i].stats));
+#endif
+    }
+#if PROFILE
+    pthread_mutex_lock(&profile_lock);
+    profile_clear_live(false);
+    pthread_mutex_unlock(&profile_lock);
+#endif
+    
+    heap_gen++;
+    return true;
+}
+
+/* Block Function: split_block
+ * ---------------------
+ * Updates the fields in block to split it into two parts: 
+ * a malloc'd block and a free block with the corresponding sizes.
+ * By default the free part stays at the front; with SPLIT_FREE_FIRST
+ * set to 0, the malloc'd part does, and the free part carries what 
+ * is left of the block's zeroed range. 
+ */
+static inline void *split_block(struct arena *a, void *block, size_t malloc_bytes, size_t free_bytes)
+{
+#if !SPLIT_FREE_FIRST
+    size_t zero_from = get_zero_from(block);
+    size_t used = malloc_bytes + HDR_SIZE;
+
+    // Set up the malloc'd block size and status
+    set_hdr_size(block, malloc_bytes);
+    set_curr_alloc(block, ALLOC);
+
+    // Write Free Block 
+    void *free_block = get_next_block(block);
+    write_header(free_block, free_bytes, FREE, ALLOC);
+    write_footer(free_block);
+    if (zero_from != 0) zero_from = zero_from > used + ZERO_MIN ? zero_from - used : ZERO_MIN;
+    set_zero_from(free_block, zero_from);
+    insert_free_list(a, free_block);
+
+    return block;
+#else
+    // Write Free Block 
+    set_hdr_size(block, free_bytes);
+    set_curr_alloc(block, FREE);
+    write_footer(block);
+    insert_free_list(a, block);
+
+    // Set up the malloc'd block size and status    
+    void *malloc_block = get_next_block(block);
+    write_header(malloc_block, malloc_bytes, ALLOC, FREE);
+
+    // Update Next Block
+    void *next_block = get_next_block(malloc_block);
+    set_prev_alloc(next_block, ALLOC);
+
+    return malloc_block;
+#endif
+}
+
+
+/* Function: heap_search 
+ * ---------------------
+ * Attempts to search for the first free block with enough size (with 
+ * QUICKLIST, coalescing the quick lists before giving up). Returns a 
+ * free block of at least adjustedsz bytes, still on its free list, or 
+ * NULL if none fits. Caller must hold the arena's lock. 
+ */
+static void *heap_search(struct arena *a, size_t adjustedsz)
+{
+    // A/B Test whether to use first fit or best fit (or TLSF)
+    void *block; 
+#if TLSF
+    block = tlsf_fit(a, adjustedsz);
+#else
+    if (BEST1_FIRST0 == 1) {
+        block = best_fit(a, adjustedsz);
+    } else {
+        block = first_fit(a, adjustedsz);
+    }
+#if SIZE_TREE
+    if (block == NULL) block = tree_fit(a, adjustedsz);
+#endif
+#endif
+
+#if QUICKLIST
+    // Coalesce the deferred blocks and search again before growing
+    if (block == NULL && a->quick_total > 0) {
+        quick_consolidate(a);
+        return heap_search(a, adjustedsz);
+    }
+#endif
+    return block;
+}
+
+/* Function: heap_find 
+ * -------------------
+ * Like heap_search, but if no free block fits, requests additional pages
+ * and formats them as a free block (adding the appropriate epilogue 
+ * header), in a new segment if the last one is full. Returns NULL only 
+ * if the arena cannot grow. Caller must hold the arena's lock. 
+ */
+static void *heap_find(struct arena *a, size_t adjustedsz)
+{
+    void *block = heap_search(a, adjustedsz);
+
+    // Request additional pages if no block found
+    if (block == NULL) { // Requests new page(s) and extends heap
+        size_t nbytes = roundup(adjustedsz + HDR_SIZE, GROW_SIZE);  //block plus the new epilogue
+
+        // Attempt to Extend Heap, or failing that start a new segment
+        block = extend_arena(a, nbytes / PAGE_SIZE);
+        if (block == NULL) return add_segment(a, adjustedsz);
+
+        // Format new page as a free block
+        if (get_prev_alloc(block) == FREE) {
+            // Merge with previous block
+            void* prev_block = get_prev_block(block);
+            size_t prev_size = get_hdr_size(prev_block); 
+            size_t totalsz = prev_size + nbytes; 
+            size_t zero_from = get_zero_from(prev_block);
+            if (zero_from != 0) {
+                // Clear the old mark, footer and epilogue, now interior
+                memset((char *)block - HDR_SIZE - 2 * FTR_SIZE, 0, HDR_SIZE + 2 * FTR_SIZE);
+            } else {
+                zero_from = (char *)block - (char *)prev_block;     //fresh pages only
+            }
+            set_hdr_size(prev_block, totalsz);
             write_footer(prev_block);
-            update_bucket(prev_block, prev_size, totalsz);        
+            set_zero_from(prev_block, zero_from);
+            update_bucket(a, prev_block, prev_size, totalsz);        
             block = prev_block;
         } else {
-            // Update old epilogue header
-            set_hdr_size(block, nbytes - HDR_SIZE);
-            set_curr_alloc(block, FREE);
-            write_footer(block);
-            insert_free_list(block);
+            // Update old epilogue header
+            set_hdr_size(block, nbytes - HDR_SIZE);
+            set_curr_alloc(block, FREE);
+            write_footer(block);
+            set_zero_from(block, ZERO_MIN);
+            insert_free_list(a, block);
+        }
+
+        // Write New Epilogue Header
+        void *epilogue_hdr = get_next_block(block); 
+        write_header(epilogue_hdr, 0 , ALLOC, FREE);
+    }
+    return block;
+}
+
+/* Function: heap_place 
+ * --------------------
+ * Takes a free block found by heap_find off its list and decides to 
+ * allocate the entire block or split it (see split_block for which 
+ * part stays free). Returns malloc'd block of at least adjustedsz 
+ * bytes. Caller must hold the arena's lock. 
+ */
+static void *heap_place(struct arena *a, void *block, size_t adjustedsz)
+{
+    // Decide whole block allocation OR split the page
+    size_t totalsz = get_hdr_size(block);
+    if (totalsz < adjustedsz + HDR_SIZE + MIN_BLK_SZ) { 
+        // Whole Block Allocation
+        set_curr_alloc(block, ALLOC);   //update Malloc'd Header
+        set_prev_alloc(get_next_block(block), ALLOC);
+        remove_free_list(a, block);        //remove from free list
+        clear_release_mark(block);
+    } else {
+        // Split Block - Free and Malloc'd
+        size_t free_bytes = totalsz - adjustedsz - HDR_SIZE;  //bytes left for a free block
+        remove_free_list(a, block);        //remove from free list
+        clear_release_mark(block);      //either part may merge back to this size
+        block = split_block(a, block, adjustedsz, free_bytes);
+        STAT_ADD(a, splits, 1);
+    }
+
+    return block; 
+}
+
+/* Function: heap_malloc 
+ * ---------------------
+ * Finds a free block of at least adjustedsz bytes, making one by growing
+ * the arena only if may_grow is set, and allocates from it. Caller must 
+ * hold the arena's lock. 
+ */
+static void *heap_malloc(struct arena *a, size_t adjustedsz, bool may_grow)
+{
+#if QUICKLIST
+    void *quick = quick_get(a, adjustedsz);
+    if (quick != NULL) return quick;
+#endif
+    void *block = may_grow ? heap_find(a, adjustedsz) : heap_search(a, adjustedsz);
+    if (block == NULL) return NULL;
+    return heap_place(a, block, adjustedsz);
+}
+
+/* Function: heap_calloc 
+ * ---------------------
+ * Like heap_malloc, but also reports through dirty how many leading 
+ * payload bytes may be non-zero, judged from the free block it came 
+ * from. The last two words (old release mark and footer) may be 
+ * non-zero as well. Caller must hold the arena's lock. 
+ */
+static void *heap_calloc(struct arena *a, size_t adjustedsz, size_t *dirty)
+{
+    void *block = heap_find(a, adjustedsz);
+    if (block == NULL) return NULL;
+    size_t zero_from = get_zero_from(block);
+    void *result = heap_place(a, block, adjustedsz);
+
+    size_t offset = (char *)result - (char *)block;
+    size_t size = get_hdr_size(result);
+    if (zero_from == 0)             *dirty = size;
+    else if (zero_from <= offset)   *dirty = 0;
+    else                            *dirty = zero_from - offset < size ? zero_from - offset : size;
+    return result;
+}
+
+/* Function: heap_malloc_batch
+ * ---------------------------
+ * Allocates one block large enough for n blocks of adjustedsz bytes 
+ * laid end to end, then carves it into n allocated blocks by writing 
+ * their headers. The last block keeps any slack. Returns false, with 
+ * nothing allocated, if the arena cannot supply the space. Caller must 
+ * hold the arena's lock. 
+ */
+static bool heap_malloc_batch(struct arena *a, size_t adjustedsz, size_t n, void **out)
+{
+    size_t stride = adjustedsz + HDR_SIZE;
+    void *block = heap_malloc(a, n * stride - HDR_SIZE, true);
+    if (block == NULL) return false;
+
+    size_t totalsz = get_hdr_size(block);
+    set_hdr_size(block, n == 1 ? totalsz : adjustedsz);    //keeps its prev_alloc
+    out[0] = block;
+    for (size_t i = 1; i < n; i++) {
+        void *bp = (char *)block + i * stride;
+        size_t size = (i == n - 1) ? totalsz - i * stride : adjustedsz;
+        write_header(bp, size, ALLOC, ALLOC);
+        out[i] = bp;
+    }
+    return true;
+}
+
+/* Function: coalesce
+ * ------------------
+ * Frees a malloc'd block and checks the neighboring blocks
+ * to check for possible coalescing. There are four cases:
+ * 
+ * Case 1: (AFA) Previous Allocated and Next Allocated
+ *      No merging/coalescing.
+ *      Free the current block.
+ *      Set the prev_alloc of the next block to FREE.
+ *      Insert current block into free list. 
+ *
+ * Case 2: (AFF) Previous Allocated and Next Free 
+ *      Merge with the next block. 
+ *      Free the current block.
+ *      Update new size in current block.
+ *      Remove next block from free list.
+ *      Insert current block into free list.
+ *
+ * Case 3: (FFA) Previous Free and Next Allocated 
+ *      Merge with the previous block.
+ *      Update new size in previous block.
+ *      Update the bucket for the previous block. 
+ *      Set the prev_alloc of the next block to FREE.
+ *
+ * Case 4: (FFF) Previous Free and Next Free 
+ *      Merge with the previous and next blocks.
+ *      Update new size in previous block.
+ *      Update the bucket for the previous block. 
+ *      Removes next block from free list. 
+ * 
+ * Returns pointer to coalesced free block. 
+ */
+static inline void *coalesce(struct arena *a, void *curr_block)
+{
+    void *result = NULL; 
+    void *next_block = get_next_block(curr_block);
+
+    bool prev_alloc = (get_prev_alloc(curr_block) == ALLOC);
+    bool next_alloc = (get_curr_alloc(next_block) == ALLOC);
+
+    size_t curr_size = get_hdr_size(curr_block);
+    size_t next_size = get_hdr_size(next_block);
+
+    // Only a free next block can leave the merged block with a zero tail
+    size_t next_zero = next_alloc ? 0 : get_zero_from(next_block);
+
+    if (prev_alloc && next_alloc) {             /* Case 1: Do Nothing */
+        set_curr_alloc(curr_block, FREE);
+        write_footer(curr_block);
+        set_zero_from(curr_block, 0);
+        set_prev_alloc(next_block, FREE);
+        insert_free_list(a, curr_block);
+        result = curr_block;
+        STAT_ADD(a, coalesce[0], 1);
+    } else if (prev_alloc && !next_alloc) {     /* Case 2: Merge with Next */
+        size_t new_size = curr_size + next_size + HDR_SIZE;
+        remove_free_list(a, next_block);       //before a minimum block's zero word lands on its header
+        set_hdr_size(curr_block, new_size);
+        set_curr_alloc(curr_block, FREE);
+        write_footer(curr_block);
+        set_zero_from(curr_block, next_zero ? curr_size + HDR_SIZE + next_zero : 0);
+        insert_free_list(a, curr_block);
+        result = curr_block;
+        STAT_ADD(a, coalesce[1], 1);
+    } else if (!prev_alloc && next_alloc) {     /* Case 3: Merge with Prev */
+        void* prev_block = get_prev_block(curr_block);
+        size_t prev_size = get_hdr_size(prev_block); 
+        size_t new_size = prev_size + curr_size + HDR_SIZE; 
+        set_hdr_size(prev_block, new_size);
+        write_footer(prev_block);
+        set_zero_from(prev_block, 0);
+        update_bucket(a, prev_block, prev_size, new_size);        
+        set_prev_alloc(next_block, FREE);
+        result = prev_block;
+        STAT_ADD(a, coalesce[2], 1);
+    } else if (!prev_alloc && !next_alloc) {    /* Case 4: Merge with Both */
+        void *prev_block = get_prev_block(curr_block);
+        size_t prev_size = get_hdr_size(prev_block); 
+        size_t new_size = prev_size + curr_size + next_size + 2 * HDR_SIZE; 
+        set_hdr_size(prev_block, new_size);
+        write_footer(prev_block);
+        set_zero_from(prev_block, next_zero ? prev_size + curr_size + 2 * HDR_SIZE + next_zero : 0);
+        update_bucket(a, prev_block, prev_size, new_size);
+        remove_free_list(a, next_block);           //remove the next block from list
+        result = prev_block;
+        STAT_ADD(a, coalesce[3], 1);
+    }
+
+    return result;
+}
+
+
+/* Function: heap_aligned_malloc
+ * -----------------------------
+ * Allocates a block of adjustedsz bytes whose payload is a multiple of 
+ * alignment. Takes a block with room for the worst-case slack, then 
+ * frees the leading slack (at least a minimum block, so it can stand on 
+ * its own) and any trailing slack worth splitting through coalesce, 
+ * which merges them with free neighbors. Caller must hold the lock. 
+ */
+static void *heap_aligned_malloc(struct arena *a, size_t alignment, size_t adjustedsz)
+{
+    size_t min_lead = MIN_BLK_SZ + HDR_SIZE;
+    void *block = heap_malloc(a, adjustedsz + alignment + min_lead, true);
+    if (block == NULL) return NULL;
+    size_t totalsz = get_hdr_size(block);
+
+    // Place the payload, leaving either no slack or a whole free block
+    uintptr_t addr = (uintptr_t)block;
+    uintptr_t aligned = roundup(addr, alignment);
+    if (aligned != addr && aligned - addr < min_lead) aligned = roundup(addr + min_lead, alignment);
+    void *result = (void *)aligned;
+    size_t lead = aligned - addr;
+    size_t size = totalsz - lead;
+
+    // Give back trailing slack first, while the block still owns it
+    if (size >= adjustedsz + HDR_SIZE + MIN_BLK_SZ) {
+        void *tail = (char *)result + adjustedsz + HDR_SIZE;
+        write_header(tail, size - adjustedsz - HDR_SIZE, ALLOC, ALLOC);
+        size = adjustedsz;
+        coalesce(a, tail);
+    }
+
+    if (lead == 0) {
+        set_hdr_size(block, size);
+    } else {
+        write_header(result, size, ALLOC, ALLOC);
+        set_hdr_size(block, lead - HDR_SIZE);   //keeps its prev_alloc
+        coalesce(a, block);
+    }
+    return result;
+}
+
+/* Function: heap_grow
+ * -------------------
+ * Grows an allocated block to at least adjustedsz bytes without a fresh 
+ * allocation. Tries, in order: absorbing the next block if it is free; 
+ * extending the arena when the block (with that free next block) ends 
+ * at the epilogue of its last segment; and absorbing the previous free 
+ * block as well, moving the payload down. The last two free whatever is
+ * left past adjustedsz. Returns the block's address, which changes only
+ * in the last case, or NULL if none applies. Caller must hold the 
+ * arena's lock. 
+ */
+static void *heap_grow(struct arena *a, void *bp, size_t adjustedsz)
+{
+    size_t oldsz = get_hdr_size(bp);
+    void *next_block = get_next_block(bp);
+    bool next_free = (get_curr_alloc(next_block) == FREE);
+    size_t avail = oldsz;
+    void *after = next_block;
+    if (next_free) {
+        avail += get_hdr_size(next_block) + HDR_SIZE;
+        after = get_next_block(next_block);
+    }
+
+    if (next_free && avail >= adjustedsz) {     /* Merge with Next */
+        remove_free_list(a, next_block);
+        clear_release_mark(next_block);
+        set_hdr_size(bp, avail);
+        set_prev_alloc(after, ALLOC);
+        STAT_ADD(a, realloc_merge, 1);
+        return bp;
+    }
+
+    struct segment *last = &a->segs[a->nsegs - 1];
+    if ((char *)after == last->base + last->size) { /* Extend the Heap Tail */
+        size_t nbytes = roundup(adjustedsz - avail, GROW_SIZE);
+        if (extend_arena(a, nbytes / PAGE_SIZE) != NULL) {
+            if (next_free) {
+                remove_free_list(a, next_block);
+                clear_release_mark(next_block);
+            }
+            size_t totalsz = avail + nbytes;
+            set_hdr_size(bp, totalsz);
+            write_header(get_next_block(bp), 0, ALLOC, ALLOC);
+
+            // Hand back what the rounding to GROW_SIZE added
+            if (totalsz >= adjustedsz + HDR_SIZE + MIN_BLK_SZ) {
+                set_hdr_size(bp, adjustedsz);
+                void *tail = get_next_block(bp);
+                write_header(tail, totalsz - adjustedsz - HDR_SIZE, ALLOC, ALLOC);
+                coalesce(a, tail);
+            }
+            STAT_ADD(a, realloc_extend, 1);
+            return bp;
+        }
+    }
+
+    if (get_prev_alloc(bp) == FREE) {           /* Merge with Prev */
+        void *prev_block = get_prev_block(bp);
+        size_t totalsz = get_hdr_size(prev_block) + HDR_SIZE + avail;
+        if (totalsz >= adjustedsz) {
+            remove_free_list(a, prev_block);
+            if (next_free) remove_free_list(a, next_block);
+            clear_release_mark(prev_block);
+            memmove(prev_block, bp, oldsz);
+            set_hdr_size(prev_block, totalsz);
+            set_curr_alloc(prev_block, ALLOC);
+            set_prev_alloc(after, ALLOC);
+
+            // Hand back the rest, which may be most of a large prev block
+            if (totalsz >= adjustedsz + HDR_SIZE + MIN_BLK_SZ) {
+                set_hdr_size(prev_block, adjustedsz);
+                void *tail = get_next_block(prev_block);
+                write_header(tail, totalsz - adjustedsz - HDR_SIZE, ALLOC, ALLOC);
+                coalesce(a, tail);
+            }
+            STAT_ADD(a, realloc_prev, 1);
+            return prev_block;
+        }
+    }
+    return NULL;
+}
+
+/* Function: heap_free
+ * -------------------
+ * Releases a slab slot or coalesces a block, then applies the decay 
+ * policy to the coalesced block. Caller must hold the lock of the arena
+ * that owns it. 
+ */
+static inline void heap_free(struct arena *a, void *ptr)
+{
+#if SLAB
+    if (is_slab(ptr)) {
+        slab_free(a, ptr);
+        return;
+    }
+#endif
+#if QUICKLIST
+    if (quick_put(a, ptr)) return;
+#endif
+    void *block = coalesce(a, ptr);
+#if SCAVENGE
+    scavenge_on_free(a, block);
+#else
+    (void)block;
+#endif
+}
+
+/* Function: heap_free_run
+ * -----------------------
+ * Frees the address-sorted blocks, all owned by one arena, merging each 
+ * run of physically adjacent blocks into a single allocated block first
+ * so that the whole run takes one coalesce. Caller must hold the lock. 
+ */
+static void heap_free_run(struct arena *a, void **blocks, size_t n)
+{
+    size_t i = 0;
+    while (i < n) {
+        void *first = blocks[i++];
+        void *end = get_next_block(first);
+        while (i < n && blocks[i] == end) end = get_next_block(blocks[i++]);
+        set_hdr_size(first, (char *)end - (char *)first - HDR_SIZE);
+        heap_free(a, first);
+    }
+}
+
+#if REMOTE_FREE
+/* Function: is_remote
+ * -------------------
+ * Returns true if a block of arena a freed by the caller should be 
+ * queued as a remote free: the caller is attached to another arena, 
+ * and a has threads of its own that will drain the queue. 
+ */
+static inline bool is_remote(struct arena *a)
+{
+    return a != get_arena() && __atomic_load_n(&a->nthreads, __ATOMIC_SEQ_CST) > 0;
+}
+
+/* Function: remote_push
+ * ---------------------
+ * Queues the chain of blocks from first to last, linked through their 
+ * first payload word and still marked allocated, on the remote stack 
+ * of arena a with a single compare-and-swap. The last thread of a may 
+ * have detached and drained since is_remote, so the push is followed by
+ * a second look at nthreads, and if none are left the caller drains the
+ * queue itself. The push and that load pair up with the decrement and 
+ * drain in thread_exit, all sequentially consistent, so at least one of
+ * the two sees the blocks. Caller must hold no arena lock. 
+ */
+static void remote_push(struct arena *a, void *first, void *last)
+{
+    void *head = __atomic_load_n(&a->remote, __ATOMIC_RELAXED);
+    do {
+        set_stack_next(last, head);
+    } while (!__atomic_compare_exchange_n(&a->remote, &head, first, true, 
+                                          __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+    if (__atomic_load_n(&a->nthreads, __ATOMIC_SEQ_CST) == 0) {
+        arena_lock(a);
+        pthread_mutex_unlock(&a->lock);
+    }
+}
+
+/* Function: remote_drain
+ * ----------------------
+ * Swaps out the whole remote stack of arena a and frees every block on 
+ * it. Only the holder of the lock pops, and it takes everything at once,
+ * so the swap cannot suffer from ABA. Caller must hold the lock. 
+ */
+static void remote_drain(struct arena *a)
+{
+    if (__atomic_load_n(&a->remote, __ATOMIC_SEQ_CST) == NULL) return;     //see remote_push
+    void *curr = __atomic_exchange_n(&a->remote, NULL, __ATOMIC_ACQUIRE);
+    STAT_ADD(a, remote_drains, 1);
+    while (curr != NULL) {
+        void *next = get_stack_next(curr);
+        heap_free(a, curr);
+        curr = next;
+    }
+}
+#endif
+
+/* Function: arena_lock
+ * --------------------
+ * Takes the lock of arena a in order to allocate from it (or trim it), 
+ * first freeing the blocks other threads have queued on it. 
+ */
+static inline void arena_lock(struct arena *a)
+{
+    pthread_mutex_lock(&a->lock);
+#if REMOTE_FREE
+    remote_drain(a);
+#endif
+}
+
+/* Function: heap_malloc_reclaim
+ * ------------------------------
+ * Allocates from arena a, growing it if need be, but before growing 
+ * hands back the calling thread's cached heap blocks, which stay marked
+ * allocated while cached and so would otherwise never coalesce into a 
+ * fit. That drops and retakes the arena's lock, which the caller holds.
+ */
+static void *heap_malloc_reclaim(struct arena *a, size_t adjustedsz)
+{
+#if TCACHE
+    if (tcache_holds(false)) {
+        void *block = heap_malloc(a, adjustedsz, false);
+        if (block != NULL) return block;
+        pthread_mutex_unlock(&a->lock);
+        tcache_release(false);
+        arena_lock(a);
+    }
+#endif
+    return heap_malloc(a, adjustedsz, true);
+}
+
+/* Function: arena_malloc
+ * ----------------------
+ * Allocates adjustedsz bytes from an arena under its lock, falling back 
+ * to arena 0 when a secondary arena has used up its reservation. 
+ */
+static void *arena_malloc(struct arena *a, size_t adjustedsz)
+{
+    arena_lock(a);
+    void *block = heap_malloc_reclaim(a, adjustedsz);
+    pthread_mutex_unlock(&a->lock);
+
+    if (block == NULL && a != &arenas[0]) return arena_malloc(&arenas[0], adjustedsz);
+    return block;
+}
+
+/* Function: arena_free
+ * --------------------
+ * Returns a slot or block to the arena that owns it, or queues it there 
+ * if that is another thread's arena. 
+ */
+static void arena_free(void *ptr)
+{
+    struct arena *a = arena_of(ptr);
+#if REMOTE_FREE
+    if (is_remote(a)) {
+        remote_push(a, ptr, ptr);
+        STAT_ADD(a, remote_frees, 1);
+        return;
+    }
+#endif
+    pthread_mutex_lock(&a->lock);
+    heap_free(a, ptr);
+    pthread_mutex_unlock(&a->lock);
+}
+
+/**** **** ****         Thread Cache Functions      **** **** ****/
+
+
+#if TCACHE
+/* Per-thread cache of freed blocks, one LIFO stack per slab class and 
+ * per small bucket. Cached blocks keep their ALLOC bit (or their slot 
+ * stays marked in use) so that nothing coalesces into them, and they are
+ * linked through the first word of their payload. A thread may cache 
+ * blocks owned by any arena. 
+ */
+struct tcache {
+    void *head[TCACHE_NCLASSES];    //top of each class's stack
+    int count[TCACHE_NCLASSES];     //blocks held in each class
+    size_t bytes;                   //usable bytes held in all classes
+    unsigned int gen;               //heap_gen the cached blocks belong to
+};
+
+static __thread struct tcache tcache;
+
+/* Cache Helper: tcache_flush
+ * --------------------------
+ * Keeps the keep most recently cached blocks of a class and returns 
+ * the rest to their arenas, taking each arena's lock once per run of 
+ * blocks that share it. A run owned by another thread's arena is queued
+ * there with one push instead. 
+ */
+static void tcache_flush(struct tcache *tc, int idx, int keep)
+{
+    void **link = &tc->head[idx];
+    for (int i = 0; i < keep && *link != NULL; i++) link = (void **)*link;
+
+    void *curr = *link;
+    *link = NULL;
+    tc->count[idx] = keep < tc->count[idx] ? keep : tc->count[idx];
+
+    struct arena *locked = NULL;
+    while (curr != NULL) {
+        struct arena *a = arena_of(curr);
+#if REMOTE_FREE
+        if (is_remote(a)) {
+            // The run is already chained; cut it off and push it whole
+            void *last = curr;
+            int n = 1;
+            tc->bytes -= get_usable_size(curr);
+            while (get_stack_next(last) != NULL && arena_of(get_stack_next(last)) == a) {
+                last = get_stack_next(last);
+                tc->bytes -= get_usable_size(last);
+                n++;
+            }
+            void *rest = get_stack_next(last);
+            if (locked != NULL) {
+                pthread_mutex_unlock(&locked->lock);
+                locked = NULL;
+            }
+            remote_push(a, curr, last);
+            STAT_ADD(a, remote_frees, n);
+            curr = rest;
+            continue;
+        }
+#endif
+        void *next = get_stack_next(curr);
+        tc->bytes -= get_usable_size(curr);
+        if (a != locked) {
+            if (locked != NULL) pthread_mutex_unlock(&locked->lock);
+            pthread_mutex_lock(&a->lock);
+            locked = a;
+        }
+        heap_free(a, curr);
+        curr = next;
+    }
+    if (locked != NULL) pthread_mutex_unlock(&locked->lock);
+}
+
+/* Cache Helper: tcache_prepare
+ * ----------------------------
+ * Returns the calling thread's cache, first dropping its contents if 
+ * myinit has reset the heap since they were cached. 
+ */
+static inline struct tcache *tcache_prepare(void)
+{
+    struct tcache *tc = &tcache;
+    if (tc->gen != heap_gen) {
+        memset(tc->head, 0, sizeof(tc->head));
+        memset(tc->count, 0, sizeof(tc->count));
+        tc->bytes = 0;
+        tc->gen = heap_gen;
+    }
+    return tc;
+}
+
+/* Cache Helper: tcache_refill_one
+ * --------------------------------
+ * Carves one block for class idx out of an arena: a slot for the slab 
+ * classes, otherwise a block of adjustedsz bytes (see 
+ * heap_malloc_reclaim). A slot may come from a new slab page only if 
+ * may_grow is set, and then the thread's cached slots are released 
+ * first, since they may empty a page for reuse. Caller must hold the 
+ * arena's lock. 
+ */
+static inline void *tcache_refill_one(struct arena *a, int idx, size_t adjustedsz, bool may_grow)
+{
+#if SLAB
+    if (idx < TCACHE_NSLABS) {
+        if (a->slabs[idx] == NULL && !may_grow) return NULL;
+        if (a->slabs[idx] == NULL && tcache_holds(true)) {
+            pthread_mutex_unlock(&a->lock);
+            tcache_release(true);
+            arena_lock(a);
+        }
+        return slab_malloc(a, idx);
+    }
+#endif
+    (void)may_grow;
+    return heap_malloc_reclaim(a, adjustedsz);
+}
+
+/* Cache Function: tcache_get
+ * --------------------------
+ * Pops a cached block of at least adjustedsz bytes from class idx, 
+ * looking at most BUCKET_CUTOFF blocks deep. On a miss, carves the 
+ * caller's block from the thread's arena, and for a slab class refills 
+ * the class with a batch of slots from slabs that have room. Returns 
+ * NULL only if the heap (or, for slab classes, the slab range) cannot 
+ * grow. 
+ */
+static void *tcache_get(size_t adjustedsz, int idx)
+{
+    struct tcache *tc = tcache_prepare();
+
+    void **link = &tc->head[idx];
+    for (int n = 0; *link != NULL && n < BUCKET_CUTOFF; n++) {
+        void *block = *link;
+        if (get_usable_size(block) >= adjustedsz) {
+            *link = get_stack_next(block);
+            tc->count[idx]--;
+            tc->bytes -= get_usable_size(block);
+            return block;
+        }
+        link = (void **)block;
+    }
+
+    // Miss: carve one block for the caller, plus a batch of slots for the
+    // cache. Heap blocks are only cached as they are freed, since carving 
+    // spares ahead of time splits free blocks that may never be used. 
+    int nrefill = 0;
+    if (idx < TCACHE_NSLABS) {
+        size_t room = TCACHE_BYTES > tc->bytes ? TCACHE_BYTES - tc->bytes : 0;
+        nrefill = TCACHE_COUNT - tc->count[idx];
+        if (nrefill > TCACHE_BATCH - 1) nrefill = TCACHE_BATCH - 1;
+        if ((size_t)nrefill > room / adjustedsz) nrefill = room / adjustedsz;
+    }
+
+    struct arena *a = get_arena();
+    arena_lock(a);
+    void *result = tcache_refill_one(a, idx, adjustedsz, true);
+    for (int i = 0; result != NULL && i < nrefill; i++) {
+        void *block = tcache_refill_one(a, idx, adjustedsz, false);
+        if (block == NULL) break;
+        set_stack_next(block, tc->head[idx]);
+        tc->head[idx] = block;
+        tc->count[idx]++;
+        tc->bytes += get_usable_size(block);
+    }
+    pthread_mutex_unlock(&a->lock);
+
+    if (result == NULL && idx >= TCACHE_NSLABS && a != &arenas[0]) {
+        result = arena_malloc(&arenas[0], adjustedsz);
+    }
+    return result;
+}
+
+/* Cache Function: tcache_holds, tcache_release
+ * ---------------------------------------------
+ * Whether the calling thread caches any slots (if slots is set) or heap
+ * blocks (if not), and hand them all back to their arenas. Called before
+ * the slab range or a heap grows: cached heap blocks may then coalesce 
+ * into a fit, and cached slots may empty their pages for reuse. Caller 
+ * must not hold an arena's lock to release. 
+ */
+static bool tcache_holds(bool slots)
+{
+    struct tcache *tc = tcache_prepare();
+    int first = slots ? 0 : TCACHE_NSLABS, last = slots ? TCACHE_NSLABS : TCACHE_NCLASSES;
+    for (int i = first; i < last; i++) {
+        if (tc->count[i] != 0) return true;
+    }
+    return false;
+}
+
+static void tcache_release(bool slots)
+{
+    struct tcache *tc = tcache_prepare();
+    int first = slots ? 0 : TCACHE_NSLABS, last = slots ? TCACHE_NSLABS : TCACHE_NCLASSES;
+    for (int i = first; i < last; i++) {
+        if (tc->count[i] != 0) tcache_flush(tc, i, 0);
+    }
+}
+
+/* Cache Function: tcache_put
+ * --------------------------
+ * Caches a freed block if it falls in a cached bucket, first flushing 
+ * the oldest TCACHE_BATCH blocks if the bucket is full. Returns false 
+ * if the block is too large to be cached. 
+ * NOTE: The size bits of a block only change while the caller owns it, 
+ * so they are read without the lock even if a neighbor is concurrently
+ * flipping this header's prev_alloc bit. 
+ */
+static bool tcache_put(void *block)
+{
+    int idx;
+    if (is_slab(block)) {
+        idx = get_slab(block)->cls;
+    } else {
+        idx = TCACHE_NSLABS + get_bucket_num(get_hdr_size(block));
+        if (idx >= TCACHE_NCLASSES) return false;
+    }
+
+    get_arena();        //make sure the exit destructor is installed
+    struct tcache *tc = tcache_prepare();
+    if (tc->count[idx] == TCACHE_COUNT) {
+        tcache_flush(tc, idx, TCACHE_COUNT - TCACHE_BATCH);
+    }
+    size_t size = get_usable_size(block);
+    if (tc->bytes + size > TCACHE_BYTES) {
+        tcache_flush(tc, idx, tc->count[idx] / 2);
+        if (tc->bytes + size > TCACHE_BYTES) return false;
+    }
+    set_stack_next(block, tc->head[idx]);
+    tc->head[idx] = block;
+    tc->count[idx]++;
+    tc->bytes += size;
+    return true;
+}
+
+#endif
+
+/* Arena Helper: thread_exit
+ * -------------------------
+ * Thread exit destructor. Hands every cached block back to its arena, 
+ * detaches from the thread's arena and then drains its remote frees, 
+ * so that exiting threads do not strand memory. A free that raced the 
+ * last detach and still queued is drained by its own thread instead 
+ * (see remote_push), so no block outlives the last thread on the queue.
+ * Does nothing if the heap was reset underneath us. 
+ */
+static void thread_exit(void *arg)
+{
+    struct arena *a = arg;
+    if (thread_gen != heap_gen) return;
+#if TCACHE
+    struct tcache *tc = tcache_prepare();
+    for (int i = 0; i < TCACHE_NCLASSES; i++) tcache_flush(tc, i, 0);
+#endif
+    pthread_mutex_lock(&arena_attach_lock);
+    __atomic_fetch_sub(&a->nthreads, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&arena_attach_lock);
+#if REMOTE_FREE
+    arena_lock(a);      //the queue may have no other thread left to drain it
+    pthread_mutex_unlock(&a->lock);
+#endif
+}
+
+/**** **** ****         Public Allocator Functions      **** **** ****/
+
+
+/* Function: slab_get
+ * -------------------
+ * Allocates a slot of the given class through the thread cache or 
+ * directly from the thread's arena. 
+ */
+#if SLAB
+static inline void *slab_get(int cls)
+{
+#if TCACHE
+    return tcache_get(get_slot_size(cls), cls);
+#else
+    struct arena *a = get_arena();
+    arena_lock(a);
+    void *slot = slab_malloc(a, cls);
+    pthread_mutex_unlock(&a->lock);
+    return slot;
+#endif
+}
+#endif
+
+/* Function: allocate 
+ * ------------------
+ * Serves tiny requests from slabs and small requests from the calling 
+ * thread's cache when possible, and otherwise allocates from the 
+ * thread's arena under its lock. 
+ */
+static inline void *allocate(size_t requestedsz)
+{
+    if (requestedsz == 0) return NULL;  //ignore spurious requests
+    if (requestedsz > MAX_BLK_SZ) return NULL;  //would overflow the size field
+
+#if SLAB
+    if (requestedsz <= SLAB_MAX_SZ) {
+        void *slot = slab_get((requestedsz - 1) / SLAB_QUANTUM);
+        if (slot != NULL) return slot;  //else the slab range is full
+    }
+#endif
+
+    if (requestedsz >= MMAP_THRESHOLD) {
+        void *block = mmap_malloc(requestedsz);
+        if (block != NULL) return block;    //else try the heap anyway
+    }
+
+    // Find first block with correct size
+    size_t adjustedsz = adjust_block_size(requestedsz);
+
+#if TCACHE
+    int idx = TCACHE_NSLABS + get_bucket_num(adjustedsz);
+    if (idx < TCACHE_NCLASSES) return tcache_get(adjustedsz, idx);
+#endif
+
+    return arena_malloc(get_arena(), adjustedsz);
+}
+
+/* Function: mymalloc 
+ * ------------------
+ * Custom version of malloc. See allocate. 
+ */
+void *mymalloc(size_t requestedsz)
+{
+    void *ptr = allocate(requestedsz);
+    if (ptr != NULL) {
+        STAT_ADD(get_arena(), bytes_in_use, get_usable_size(ptr));
+        profile_malloc(ptr, requestedsz);
+    }
+    return ptr;
+}
+
+/* Function: myfree 
+ * ----------------
+ * Frees the malloc'd pointer. Mapped blocks are unmapped. Slots and 
+ * small blocks go to the thread cache; others are released into their 
+ * own arena right away, or queued there if it is another thread's. 
+ */
+void myfree(void *ptr)
+{
+    if (ptr == NULL) return;
+    STAT_ADD(get_arena(), bytes_in_use, -get_usable_size(ptr));
+    profile_free(ptr);
+    if (is_mapped(ptr)) {
+        mmap_free(ptr);
+        return;
+    }
+#if TCACHE
+    if (tcache_put(ptr)) return;
+#endif
+    arena_free(ptr);
+}
+
+/* Function: mycalloc 
+ * ------------------
+ * Custom version of calloc. Mapped blocks are fresh from the kernel and 
+ * slots and cached blocks are small, so only heap blocks are worth 
+ * tracking: heap_calloc says how much of the block may be dirty, and 
+ * only that part (plus the two trailing metadata words) is cleared. 
+ */
+void *mycalloc(size_t nmemb, size_t size)
+{
+    size_t total;
+    if (__builtin_mul_overflow(nmemb, size, &total)) return NULL;
+    if (total == 0 || total > MAX_BLK_SZ) return NULL;
+
+    if (total >= MMAP_THRESHOLD) {
+        void *block = mmap_malloc(total);
+        if (block != NULL) {
+            STAT_ADD(get_arena(), bytes_in_use, get_usable_size(block));
+            profile_malloc(block, total);
+            return block;
+        }
+    }
+
+    size_t adjustedsz = adjust_block_size(total);
+    bool small = total <= SLAB_MAX_SZ;
+#if TCACHE
+    small = small || TCACHE_NSLABS + get_bucket_num(adjustedsz) < TCACHE_NCLASSES;
+#endif
+    if (small) {
+        void *ptr = mymalloc(total);
+        if (ptr != NULL) memset(ptr, 0, total);
+        return ptr;
+    }
+
+    struct arena *a = get_arena();
+    size_t dirty;
+    arena_lock(a);
+    void *ptr = heap_calloc(a, adjustedsz, &dirty);
+    pthread_mutex_unlock(&a->lock);
+    if (ptr == NULL && a != &arenas[0]) {
+        arena_lock(&arenas[0]);
+        ptr = heap_calloc(&arenas[0], adjustedsz, &dirty);
+        pthread_mutex_unlock(&arenas[0].lock);
+    }
+    if (ptr == NULL) return NULL;
+
+    size_t usable = get_hdr_size(ptr);
+    STAT_ADD(arena_of(ptr), bytes_in_use, usable);      //a, or arena 0 if it fell back
+    profile_malloc(ptr, total);
+    memset(ptr, 0, dirty < total ? dirty : total);
+    if (dirty < usable) memset((char *)ptr + usable - 2 * FTR_SIZE, 0, 2 * FTR_SIZE);
+    return ptr;
+}
+
+/* Function: myaligned_alloc
+ * -------------------------
+ * Allocates size bytes at a multiple of alignment, which must be a power 
+ * of two. Alignments up to ALIGNMENT come from mymalloc with the size 
+ * rounded to a multiple of the alignment (slab slots of such sizes are 
+ * aligned too); larger ones are placed within a heap block. 
+ */
+void *myaligned_alloc(size_t alignment, size_t size)
+{
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) return NULL;
+    if (size == 0 || size > MAX_BLK_SZ) return NULL;
+    if (alignment <= ALIGNMENT) return mymalloc(roundup(size, alignment));
+    if (alignment > MAX_BLK_SZ / 2 || size > MAX_BLK_SZ / 2 - alignment) return NULL;
+
+    size_t adjustedsz = adjust_block_size(size);
+    struct arena *a = get_arena();
+    arena_lock(a);
+    void *ptr = heap_aligned_malloc(a, alignment, adjustedsz);
+    pthread_mutex_unlock(&a->lock);
+    if (ptr == NULL && a != &arenas[0]) {
+        arena_lock(&arenas[0]);
+        ptr = heap_aligned_malloc(&arenas[0], alignment, adjustedsz);
+        pthread_mutex_unlock(&arenas[0].lock);
+    }
+    if (ptr != NULL) {
+        STAT_ADD(arena_of(ptr), bytes_in_use, get_hdr_size(ptr));    //a, or arena 0 if it fell back
+        profile_malloc(ptr, size);
+    }
+    return ptr;
+}
+
+/* Function: myposix_memalign
+ * --------------------------
+ * posix_memalign on top of myaligned_alloc: alignment must be a power of
+ * two multiple of sizeof(void *). Returns 0 and stores the block in 
+ * memptr, or EINVAL/ENOMEM. 
+ */
+int myposix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0) return EINVAL;
+    void *ptr = myaligned_alloc(alignment, size);
+    if (ptr == NULL && size != 0) return ENOMEM;
+    *memptr = ptr;
+    return 0;
+}
+
+/* Function: mymalloc_batch
+ * ------------------------
+ * Allocates n blocks of size bytes into out and returns how many it 
+ * managed (fewer than n only if memory ran out). Heap-sized blocks are 
+ * carved back to back from one free block under a single lock; slab 
+ * and mapped sizes are allocated one at a time. 
+ */
+size_t mymalloc_batch(size_t size, size_t n, void **out)
+{
+    if (size == 0 || n == 0) return 0;
+    size_t count = 0;
+
+    if (size > SLAB_MAX_SZ && size < MMAP_THRESHOLD) {
+        size_t adjustedsz = adjust_block_size(size);
+        if (n <= MAX_BLK_SZ / (adjustedsz + HDR_SIZE)) {
+            struct arena *a = get_arena();
+            arena_lock(a);
+            bool ok = heap_malloc_batch(a, adjustedsz, n, out);
+            pthread_mutex_unlock(&a->lock);
+            if (!ok && a != &arenas[0]) {
+                arena_lock(&arenas[0]);
+                ok = heap_malloc_batch(&arenas[0], adjustedsz, n, out);
+                pthread_mutex_unlock(&arenas[0].lock);
+            }
+            if (ok) {
+                count = n;
+                STAT_ADD(arena_of(out[0]), bytes_in_use, (n - 1) * adjustedsz + get_hdr_size(out[n - 1]));
+                for (size_t i = 0; i < n; i++) profile_malloc(out[i], size);
+            }
+        }
+    }
+    
+    // Slab and mapped sizes, or a heap too fragmented for one run
+    for (; count < n; count++) {
+        out[count] = mymalloc(size);
+        if (out[count] == NULL) break;
+    }
+    return count;
+}
+
+static int cmp_addr(const void *a, const void *b)
+{
+    uintptr_t x = (uintptr_t)*(void *const *)a, y = (uintptr_t)*(void *const *)b;
+    return (x > y) - (x < y);
+}
+
+/* Function: myfree_batch
+ * ----------------------
+ * Frees n pointers (NULLs are skipped). Slots and mapped blocks are freed
+ * one by one; heap blocks are sorted by address, which also groups them 
+ * by arena, and each arena's blocks are freed under one lock with 
+ * adjacent blocks coalesced together, or queued on it with one push if
+ * it is another thread's arena. Reorders ptrs. 
+ */
+void myfree_batch(void **ptrs, size_t n)
+{
+    // Hand off slots and mapped blocks, compacting heap blocks to the front
+    size_t nheap = 0;
+    for (size_t i = 0; i < n; i++) {
+        void *ptr = ptrs[i];
+        if (ptr == NULL) continue;
+        if (is_slab(ptr) || is_mapped(ptr)) {
+            myfree(ptr);
+        } else {
+            STAT_ADD(get_arena(), bytes_in_use, -get_hdr_size(ptr));
+            profile_free(ptr);
+            ptrs[nheap++] = ptr;
+        }
+    }
+    qsort(ptrs, nheap, sizeof(void *), cmp_addr);
+
+    size_t i = 0;
+    while (i < nheap) {
+        struct arena *a = arena_of(ptrs[i]);
+        size_t j = i + 1;
+        while (j < nheap && arena_of(ptrs[j]) == a) j++;
+#if REMOTE_FREE
+        if (is_remote(a)) {
+            for (size_t k = i; k + 1 < j; k++) set_stack_next(ptrs[k], ptrs[k + 1]);
+            remote_push(a, ptrs[i], ptrs[j - 1]);
+            STAT_ADD(a, remote_frees, j - i);
+            i = j;
+            continue;
+        }
+#endif
+        pthread_mutex_lock(&a->lock);
+        heap_free_run(a, ptrs + i, j - i);
+        pthread_mutex_unlock(&a->lock);
+        i = j;
+    }
+}
+
+/* Function: myrealloc 
+ * -------------------
+ * Resizes mapped blocks that stay large with mremap, and otherwise 
+ * tries myrealloc_inplace. If the block can neither be reused nor grown
+ * into its neighbors, malloc a new block and free the old pointer. 
+ */
+void *myrealloc(void *oldptr, size_t newsz)
+{   
+    // If oldptr == NULL, equivalent to mymalloc(newsz)
+    if (oldptr == NULL) {
+        return mymalloc(newsz);
+    }
+    // If newsz == 0, and oldptr != NULL, free(oldptr)
+    if (newsz == 0) {
+        myfree(oldptr);
+        return NULL;
+    }
+    if (newsz > MAX_BLK_SZ) return NULL;    //would overflow the size field
+
+    size_t oldsz = get_usable_size(oldptr);
+    if (is_mapped(oldptr) && newsz >= MMAP_THRESHOLD) {
+        void *newptr = mmap_realloc(oldptr, newsz, true);
+        if (newptr != NULL) {
+            STAT_ADD(get_arena(), realloc_remap, 1);
+            STAT_ADD(get_arena(), bytes_in_use, get_usable_size(newptr) - oldsz);
+            profile_move(oldptr, newptr);
+        }
+        return newptr;
+    }
+    void *newptr = myrealloc_inplace(oldptr, newsz);
+    if (newptr != NULL) return newptr;
+
+    // Malloc a new block
+    newptr = mymalloc(newsz * REALLOC_MULT);
+    if (newptr == NULL) return NULL; 
+    STAT_ADD(get_arena(), realloc_copy, 1);
+    memcpy(newptr, oldptr, oldsz < newsz ? oldsz: newsz);
+    myfree(oldptr);
+    return newptr;
+}
+
+/* Function: myrealloc_inplace 
+ * ---------------------------
+ * Resizes a block without allocating a new one. Reuses the block or 
+ * slab slot if it is big enough, resizes a mapped block only where it 
+ * lies, and grows a heap block into its free neighbors or past the heap
+ * tail (see heap_grow). Returns the block, which may have moved down into
+ * the previous free block, or NULL (leaving it untouched) if it cannot 
+ * be resized this way. 
+ */
+void *myrealloc_inplace(void *oldptr, size_t newsz)
+{
+    if (oldptr == NULL || newsz == 0 || newsz > MAX_BLK_SZ) return NULL;
+
+    size_t oldsz = get_usable_size(oldptr);
+    void *newptr = NULL;
+    if (is_slab(oldptr)) {
+        // Reuse only within the same class, since smaller classes may 
+        // promise stricter alignment than this slot has
+        if ((newsz - 1) / SLAB_QUANTUM == get_slab(oldptr)->cls) {
+            STAT_ADD(get_arena(), realloc_reuse, 1);
+            return oldptr;
+        }
+    } else if (is_mapped(oldptr)) {
+        if (newsz >= MMAP_THRESHOLD) newptr = mmap_realloc(oldptr, newsz, false);
+        if (newptr != NULL) STAT_ADD(get_arena(), realloc_remap, 1);
+    } else if (adjust_block_size(newsz) <= oldsz) { //try to reuse block
+        STAT_ADD(get_arena(), realloc_reuse, 1);
+        return oldptr;
+    } else { //try to grow into the neighbors
+        struct arena *a = arena_of(oldptr);
+        pthread_mutex_lock(&a->lock);
+        newptr = heap_grow(a, oldptr, adjust_block_size(newsz));
+        pthread_mutex_unlock(&a->lock);
+    }
+    if (newptr != NULL) {
+        STAT_ADD(get_arena(), bytes_in_use, get_usable_size(newptr) - oldsz);
+        profile_move(oldptr, newptr);
+    }
+    return newptr;
+}
+
+/* Function: myfootprint
+ * ---------------------
+ * Bytes the allocator currently holds from the OS: the pages handed out
+ * in every arena's segments, the slab pages handed out so far, and 
+ * mapped blocks. Pages released by scavenging still count, since they 
+ * stay reserved. 
+ */
+size_t myfootprint(void)
+{
+    size_t total = __atomic_load_n(&mapped_bytes, __ATOMIC_RELAXED);
+    for (int i = 0; i < NARENAS; i++) {
+        int nsegs = __atomic_load_n(&arenas[i].nsegs, __ATOMIC_ACQUIRE);
+        for (int j = 0; j < nsegs; j++) {
+            total += __atomic_load_n(&arenas[i].segs[j].size, __ATOMIC_RELAXED);
+        }
+    }
+    total += __atomic_load_n(&slab_seg.size, __ATOMIC_RELAXED);
+    return total;
+}
+
+/* Function: myusable_size
+ * ------------------------
+ * Number of bytes the caller may use behind a pointer from mymalloc, 
+ * which can exceed the size it asked for. 
+ */
+size_t myusable_size(void *ptr)
+{
+    return ptr == NULL ? 0 : get_usable_size(ptr);
+}
+
+/* Function: mylock_all, myunlock_all, myfork_child
+ * ------------------------------------------------
+ * Take and release every allocator lock, in a fixed order, around a 
+ * fork so that the child never inherits a lock held by a thread that no
+ * longer exists there. 
+ */
+void mylock_all(void)
+{
+    pthread_mutex_lock(&arena_attach_lock);
+    for (int i = 0; i < NARENAS; i++) pthread_mutex_lock(&arenas[i].lock);
+    pthread_mutex_lock(&slab_lock);
+#if PROFILE
+    pthread_mutex_lock(&profile_lock);
+#endif
+}
+
+void myunlock_all(void)
+{
+#if PROFILE
+    pthread_mutex_unlock(&profile_lock);
+#endif
+    pthread_mutex_unlock(&slab_lock);
+    for (int i = NARENAS - 1; i >= 0; i--) pthread_mutex_unlock(&arenas[i].lock);
+    pthread_mutex_unlock(&arena_attach_lock);
+}
+
+void myfork_child(void)
+{
+    // Only the forking thread lives on: the arenas' thread counts would 
+    // otherwise keep queueing frees for threads that will never drain 
+    // them, and the scavenger is gone, possibly holding its lock 
+    for (int i = 0; i < NARENAS; i++) arenas[i].nthreads = 0;
+    if (thread_arena != NULL && thread_gen == heap_gen) thread_arena->nthreads = 1;
+    scavenger_running = false;
+    pthread_mutex_init(&scavenger_lock, NULL);
+    pthread_cond_init(&scavenger_wake, NULL);
+    myunlock_all();
+}
+
+/* Function: mystats
+ * -----------------
+ * Sums every arena's counters into st and fills in the footprint. 
+ * Returns false (leaving only bytes_mapped set) if the allocator was 
+ * built without STATS. 
+ */
+bool mystats(struct mystats *st)
+{
+    memset(st, 0, sizeof(*st));
+    st->bytes_mapped = myfootprint();
+#if STATS
+    for (int i = 0; i < NARENAS; i++) {
+        struct mystats *as = &arenas[i].stats;
+        st->bytes_in_use += __atomic_load_n(&as->bytes_in_use, __ATOMIC_RELAXED);
+        st->extend_calls += __atomic_load_n(&as->extend_calls, __ATOMIC_RELAXED);
+        st->splits += __atomic_load_n(&as->splits, __ATOMIC_RELAXED);
+        for (int j = 0; j < 4; j++) {
+            st->coalesce[j] += __atomic_load_n(&as->coalesce[j], __ATOMIC_RELAXED);
+        }
+        for (int j = 0; j < NBUCKETS; j++) {
+            st->fit_examined[j] += __atomic_load_n(&as->fit_examined[j], __ATOMIC_RELAXED);
+        }
+        st->cutoff_hits += __atomic_load_n(&as->cutoff_hits, __ATOMIC_RELAXED);
+        st->fit_cache_hits += __atomic_load_n(&as->fit_cache_hits, __ATOMIC_RELAXED);
+        st->realloc_reuse += __atomic_load_n(&as->realloc_reuse, __ATOMIC_RELAXED);
+        st->realloc_merge += __atomic_load_n(&as->realloc_merge, __ATOMIC_RELAXED);
+        st->realloc_extend += __atomic_load_n(&as->realloc_extend, __ATOMIC_RELAXED);
+        st->realloc_prev += __atomic_load_n(&as->realloc_prev, __ATOMIC_RELAXED);
+        st->realloc_remap += __atomic_load_n(&as->realloc_remap, __ATOMIC_RELAXED);
+        st->realloc_copy += __atomic_load_n(&as->realloc_copy, __ATOMIC_RELAXED);
+        st->quick_hits += __atomic_load_n(&as->quick_hits, __ATOMIC_RELAXED);
+        st->consolidations += __atomic_load_n(&as->consolidations, __ATOMIC_RELAXED);
+        st->remote_frees += __atomic_load_n(&as->remote_frees, __ATOMIC_RELAXED);
+        st->remote_drains += __atomic_load_n(&as->remote_drains, __ATOMIC_RELAXED);
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+/* Function: mytrim
+ * ----------------
+ * Frees the blocks queued as remote frees, then releases the free pages
+ * of every arena to the OS right away, regardless of the decay clock. 
+ */
+void mytrim(void)
+{
+    for (int i = 0; i < NARENAS; i++) {
+        struct arena *a = &arenas[i];
+        if (a->segs[0].base == NULL) continue;
+        arena_lock(a);
+        scavenge_arena(a);
+        pthread_mutex_unlock(&a->lock);
+    }
+}
+
+/* Function: myscavenge_start, myscavenge_stop
+ * -------------------------------------------
+ * Starts or stops a background thread that wakes every interval_ms 
+ * and scavenges arenas whose decay clock has run out. Starting returns 
+ * false if the thread is already running or cannot be created. 
+ */
+bool myscavenge_start(unsigned int interval_ms)
+{
+    pthread_mutex_lock(&scavenger_lock);
+    bool started = false;
+    if (!scavenger_running) {
+        scavenger_running = true;
+        started = pthread_create(&scavenger, NULL, scavenger_main, 
+                                 (void *)(uintptr_t)interval_ms) == 0;
+        scavenger_running = started;
+    }
+    pthread_mutex_unlock(&scavenger_lock);
+    return started;
+}
+
+void myscavenge_stop(void)
+{
+    pthread_mutex_lock(&scavenger_lock);
+    bool running = scavenger_running;
+    scavenger_running = false;
+    pthread_cond_signal(&scavenger_wake);
+    pthread_mutex_unlock(&scavenger_lock);
+    if (running) pthread_join(scavenger, NULL);
+}
+
+/* Function: myprofile_start, myprofile_stop
+ * -----------------------------------------
+ * Starting discards every earlier sample, maps the tables on first use 
+ * and takes one backtrace up front so that the unwinder is loaded here 
+ * rather than inside a sample. Threads pick up a new rate when their 
+ * current countdown runs out. 
+ */
+bool myprofile_start(size_t sample_bytes)
+{
+#if PROFILE
+    if (sample_bytes == 0 || sample_bytes > ((size_t)1 << 40)) return false;
+    void *pc[1];
+    profile_busy = true;
+    backtrace(pc, 1);
+    profile_busy = false;
+
+    pthread_mutex_lock(&profile_lock);
+    if (profile_stacks == NULL) {
+        void *stacks = mmap(NULL, PROFILE_STACKS * sizeof(struct profile_stack), PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        void *live = mmap(NULL, PROFILE_LIVE * sizeof(struct profile_live), PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (stacks == MAP_FAILED || live == MAP_FAILED) {
+            if (stacks != MAP_FAILED) munmap(stacks, PROFILE_STACKS * sizeof(struct profile_stack));
+            if (live != MAP_FAILED) munmap(live, PROFILE_LIVE * sizeof(struct profile_live));
+            pthread_mutex_unlock(&profile_lock);
+            return false;
         }
+        profile_stacks = stacks;
+        profile_live = live;
+    } else {
+        profile_clear_live(true);
+    }
+    profile_period = sample_bytes;
+    __atomic_store_n(&profile_rate, sample_bytes, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&profile_lock);
+    return true;
+#else
+    (void)sample_bytes;
+    return false;
+#endif
+}
+
+void myprofile_stop(void)
+{
+#if PROFILE
+    __atomic_store_n(&profile_rate, 0, __ATOMIC_RELAXED);
+#endif
+}
+
+/* Function: myprofile_signal
+ * --------------------------
+ * Installs the dump handler for signo, starting the dumper thread the 
+ * first time. Later calls may change the signal or the prefix. 
+ */
+bool myprofile_signal(int signo, const char *prefix)
+{
+#if PROFILE
+    if (prefix == NULL || strlen(prefix) >= sizeof(profile_prefix)) return false;
+    pthread_mutex_lock(&profile_lock);
+    strcpy(profile_prefix, prefix);
+    bool ok = true;
+    if (!profile_dumper_running) {
+        pthread_t dumper;
+        ok = sem_init(&profile_sem, 0, 0) == 0 && pthread_create(&dumper, NULL, profile_dumper_main, NULL) == 0;
+        if (ok) pthread_detach(dumper);
+        profile_dumper_running = ok;
+    }
+    pthread_mutex_unlock(&profile_lock);
+    if (!ok) return false;
 
-        // Write New Epilogue Header
-        void *epilogue_hdr = get_next_block(block); 
-        write_header(epilogue_hdr, 0 , ALLOC, FREE);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = profile_on_signal;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    return sigaction(signo, &sa, NULL) == 0;
+#else
+    (void)signo;
+    (void)prefix;
+    return false;
+#endif
+}
+
+/**** **** ****         Region Functions      **** **** ****/
+
+
+/* A region hands out memory by bumping top towards end within its current
+ * chunk. Chunks are REGION_CHUNK-byte blocks from mymalloc, kept in a list
+ * that starts with the chunk holding the region itself and survives a 
+ * reset, so that a reset region refills the same chunks. Requests too big
+ * to share a chunk get a block of their own on the big list, freed by the 
+ * next reset. 
+ */
+struct region_chunk {
+    struct region_chunk *next;
+    char *end;                      //first byte past the chunk
+};
+#define REGION_CHUNK_HDR    roundup(sizeof(struct region_chunk), ALIGNMENT)
+#define REGION_BIG          (REGION_CHUNK / 4)  //requests served by a block of their own
+
+struct myregion {
+    struct region_chunk *curr;      //chunk being bumped through
+    char *top;                      //next free byte in curr
+    char *end;                      //end of curr
+    struct region_chunk *big;       //blocks of requests over REGION_BIG
+};
+#define REGION_HDR          roundup(sizeof(struct myregion), ALIGNMENT)
+
+/* Region Helper: region_first
+ * ---------------------------
+ * The chunk a region lives in: the first of its list. 
+ */
+static inline struct region_chunk *region_first(struct myregion *r)
+{
+    return (struct region_chunk *)((char *)r - REGION_CHUNK_HDR);
+}
+
+/* Region Helper: region_refill
+ * ----------------------------
+ * Moves the region on to its next chunk, allocating one if the list runs
+ * out, and serves size bytes from it. Returns NULL if out of memory. 
+ */
+static void *region_refill(struct myregion *r, size_t size)
+{
+    struct region_chunk *next = r->curr->next;
+    if (next == NULL) {
+        next = mymalloc(REGION_CHUNK);
+        if (next == NULL) return NULL;
+        next->next = NULL;
+        next->end = (char *)next + REGION_CHUNK;
+        r->curr->next = next;
     }
+    r->curr = next;
+    r->top = (char *)next + REGION_CHUNK_HDR + size;
+    r->end = next->end;
+    return (char *)next + REGION_CHUNK_HDR;
+}
 
-    // Decide whole block allocation OR split the page
-    int totalsz = get_hdr_size(block);
-    int free_bytes = totalsz - adjustedsz - HDR_SIZE;    //bytes left for a free block
-    if (free_bytes < MIN_BLK_SZ) { 
-        // Whole Block Allocation
-        set_curr_alloc(block, ALLOC);   //update Malloc'd Header
-        set_prev_alloc(get_next_block(block), ALLOC);
-        remove_free_list(block);        //remove from free list
-    } else {
-        // Split Block - Free and Malloc'd
-        remove_free_list(block);        //remove from free list
-        block = split_block(block, adjustedsz, free_bytes);
+/* Region Helper: region_free_big
+ * ------------------------------
+ * Frees the blocks of every request that had a block of its own. 
+ */
+static void region_free_big(struct myregion *r)
+{
+    for (struct region_chunk *c = r->big, *next; c != NULL; c = next) {
+        next = c->next;
+        myfree(c);
     }
+    r->big = NULL;
+}
 
-    return block; 
+/* Function: myregion_create
+ * -------------------------
+ * Allocates the region's first chunk and places the region at its start.
+ */
+struct myregion *myregion_create(void)
+{
+    struct region_chunk *first = mymalloc(REGION_CHUNK);
+    if (first == NULL) return NULL;
+    first->next = NULL;
+    first->end = (char *)first + REGION_CHUNK;
+    struct myregion *r = (struct myregion *)((char *)first + REGION_CHUNK_HDR);
+    r->curr = first;
+    r->top = (char *)r + REGION_HDR;
+    r->end = first->end;
+    r->big = NULL;
+    return r;
 }
 
-/* Function: coalesce
- * ------------------
- * Frees a malloc'd block and checks the neighboring blocks
- * to check for possible coalescing. There are four cases:
- * 
- * Case 1: (AFA) Previous Allocated and Next Allocated
- *      No merging/coalescing.
- *      Free the current block.
- *      Set the prev_alloc of the next block to FREE.
- *      Insert current block into free list. 
- *
- * Case 2: (AFF) Previous Allocated and Next Free 
- *      Merge with the next block. 
- *      Free the current block.
- *      Update new size in current block.
- *      Remove next block from free list.
- *      Insert current block into free list.
- *
- * Case 3: (FFA) Previous Free and Next Allocated 
- *      Merge with the previous block.
- *      Update new size in previous block.
- *      Update the bucket for the previous block. 
- *      Set the prev_alloc of the next block to FREE.
- *
- * Case 4: (FFF) Previous Free and Next Free 
- *      Merge with the previous and next blocks.
- *      Update new size in previous block.
- *      Update the bucket for the previous block. 
- *      Removes next block from free list. 
- * 
- * Returns pointer to coalesced free block. 
+/* Function: myregion_alloc
+ * ------------------------
+ * Bumps top by size rounded up to ALIGNMENT, moving on to the next chunk
+ * if it does not fit in this one. The rest of the old chunk is left 
+ * unused until the next reset. 
  */
-static inline void *coalesce(void *curr_block)
+void *myregion_alloc(struct myregion *r, size_t size)
 {
-    void *result = NULL; 
-    void *next_block = get_next_block(curr_block);
+    if (size == 0 || size > MAX_BLK_SZ - REGION_CHUNK_HDR) return NULL;
+    size = roundup(size, ALIGNMENT);
+    if (size <= (size_t)(r->end - r->top)) {
+        void *ptr = r->top;
+        r->top += size;
+        return ptr;
+    }
+    if (size <= REGION_BIG) return region_refill(r, size);
 
-    bool prev_alloc = (get_prev_alloc(curr_block) == ALLOC);
-    bool next_alloc = (get_curr_alloc(next_block) == ALLOC);
+    struct region_chunk *c = mymalloc(REGION_CHUNK_HDR + size);
+    if (c == NULL) return NULL;
+    c->next = r->big;
+    r->big = c;
+    return (char *)c + REGION_CHUNK_HDR;
+}
 
-    size_t curr_size = get_hdr_size(curr_block);
-    size_t next_size = get_hdr_size(next_block);
+/* Function: myregion_reset
+ * ------------------------
+ * Frees the blocks of big requests and rewinds to the first chunk, past 
+ * the region itself. Chunks are kept for reuse. 
+ */
+void myregion_reset(struct myregion *r)
+{
+    region_free_big(r);
+    r->curr = region_first(r);
+    r->top = (char *)r + REGION_HDR;
+    r->end = r->curr->end;
+}
 
-    if (prev_alloc && next_alloc) {             /* Case 1: Do Nothing */
-        set_curr_alloc(curr_block, FREE);
-        write_footer(curr_block);
-        set_prev_alloc(next_block, FREE);
-        insert_free_list(curr_block);
-        result = curr_block;
-    } else if (prev_alloc && !next_alloc) {     /* Case 2: Merge with Next */
-        size_t new_size = curr_size + next_size + HDR_SIZE;
-        set_hdr_size(curr_block, new_size);
-        set_curr_alloc(curr_block, FREE);
-        write_footer(curr_block);
-        insert_free_list(curr_block);
-        remove_free_list(next_block);       //remove the next block from list
-        result = curr_block;
-    } else if (!prev_alloc && next_alloc) {     /* Case 3: Merge with Prev */
-        void* prev_block = get_prev_block(curr_block);
-        size_t prev_size = get_hdr_size(prev_block); 
-        size_t new_size = prev_size + curr_size + HDR_SIZE; 
-        set_hdr_size(prev_block, new_size);
-        write_footer(prev_block);
-        update_bucket(prev_block, prev_size, new_size);        
-        set_prev_alloc(next_block, FREE);
-        result = prev_block;
-    } else if (!prev_alloc && !next_alloc) {    /* Case 4: Merge with Both */
-        void *prev_block = get_prev_block(curr_block);
-        size_t prev_size = get_hdr_size(prev_block); 
-        size_t new_size = prev_size + curr_size + next_size + 2 * HDR_SIZE; 
-        set_hdr_size(prev_block, new_size);
-        write_footer(prev_block);
-        update_bucket(prev_block, prev_size, new_size);
-        remove_free_list(next_block);           //remove the next block from list
-        result = prev_block;
+/* Function: myregion_destroy
+ * --------------------------
+ * Frees every chunk, ending with the one the region lives in. 
+ */
+void myregion_destroy(struct myregion *r)
+{
+    if (r == NULL) return;
+    region_free_big(r);
+    struct region_chunk *first = region_first(r);
+    for (struct region_chunk *c = first->next, *next; c != NULL; c = next) {
+        next = c->next;
+        myfree(c);
     }
+    myfree(first);
+}
 
-    return result;
+/**** **** ****         Testing Functions      **** **** ****/
+
+/* A heap report in the making: totals gathered while walking the arenas,
+ * and a buffer of output flushed to fd with write(2), so that reporting
+ * never allocates. 
+ */
+#define REPORT_BUF_SZ   4096
+#define REPORT_LINE_MAX 256
+
+struct report {
+    int fd;
+    int format;                     //MYREPORT_JSON or MYREPORT_CSV
+    bool ok;                        //false once a write has failed
+    bool first_row;                 //no JSON element written yet
+    size_t len;                     //bytes waiting in buf
+    size_t heap_bytes;              //pages handed to the arenas
+    size_t alloc_blocks, alloc_bytes;
+    size_t free_blocks, free_bytes;
+    size_t quick_blocks, quick_bytes;
+    size_t largest_free;
+    size_t hist_count[NBUCKETS];    //free blocks per bucket
+    size_t hist_bytes[NBUCKETS];
+    size_t slab_slots[NSLAB_CLASSES];   //live slots per slab class
+    size_t slab_waste[NSLAB_CLASSES];   //bytes lost to slot and page rounding
+    char buf[REPORT_BUF_SZ];
+};
+
+/* Report Helper: report_flush
+ * ---------------------------
+ * Writes out the buffered report, retrying short writes. 
+ */
+static void report_flush(struct report *r)
+{
+    size_t done = 0;
+    while (r->ok && done < r->len) {
+        ssize_t n = write(r->fd, r->buf + done, r->len - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) r->ok = false;
+        else done += n;
+    }
+    r->len = 0;
 }
 
+/* Report Helper: report_printf
+ * ----------------------------
+ * Appends one formatted line (at most REPORT_LINE_MAX bytes) to the 
+ * report, flushing first if the buffer is nearly full. 
+ */
+__attribute__((format(printf, 2, 3)))
+static void report_printf(struct report *r, const char *fmt, ...)
+{
+    if (r->len > REPORT_BUF_SZ - REPORT_LINE_MAX) report_flush(r);
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(r->buf + r->len, REPORT_BUF_SZ - r->len, fmt, ap);
+    va_end(ap);
+    if (n > 0) r->len += n;
+}
 
-/* Function: myfree 
- * ----------------
- * Frees the malloc'd pointer and attempts to coalesce with 
- * neighboring blocks. 
+/* Report Helper: report_row
+ * -------------------------
+ * Writes one row of the report: a block, a histogram bucket or a total. 
+ * In CSV every row has the columns kind,arena,where,bytes,count, where 
+ * "where" is a block's offset in its arena, a bucket's smallest size or
+ * a slab class's slot size. 
+ * Fields that do not apply are passed as -1 and left empty. 
  */
-void myfree(void *ptr)
+static void report_row(struct report *r, const char *kind, long arena, long long where, 
+                       size_t bytes, long long count)
 {
-    if (ptr == NULL) return;
-    coalesce(ptr);
+    char arena_str[24] = "", where_str[24] = "", count_str[24] = "";
+    if (arena >= 0) snprintf(arena_str, sizeof(arena_str), "%ld", arena);
+    if (where >= 0) snprintf(where_str, sizeof(where_str), "%lld", where);
+    if (count >= 0) snprintf(count_str, sizeof(count_str), "%lld", count);
+    report_printf(r, "%s,%s,%s,%zu,%s\n", kind, arena_str, where_str, bytes, count_str);
 }
 
-/* Function: myrealloc 
- * -------------------
- * Reallocates the oldptr by checking if it is possible to reuse 
- * the block (if so, return oldptr). Next checks if it is possible 
- * to coalesce with the next block (if so, coalesces with next 
- * block and reuses pointer). Otherwise, malloc a new block
- * and free the old pointer. 
+#if QUICKLIST
+/* Report Helper: on_quick_list
+ * ----------------------------
+ * Whether an allocated-looking block is parked on one of the arena's 
+ * quick lists. Caller must hold the lock. 
  */
-void *myrealloc(void *oldptr, size_t newsz)
-{   
-    // If oldptr == NULL, equivalent to mymalloc(newsz)
-    if (oldptr == NULL) {
-        return mymalloc(newsz);
-    }
-    // If newsz == 0, and oldptr != NULL, free(oldptr)
-    if (newsz == 0) {
-        free(oldptr);
-        return NULL;
+static bool on_quick_list(struct arena *a, void *bp)
+{
+    size_t idx = (get_hdr_size(bp) - MIN_BLK_SZ) >> ALIGN_LOG2;
+    if (idx >= QUICK_NCLASSES) return false;
+    for (void *curr = a->quick[idx]; curr != NULL; curr = get_stack_next(curr)) {
+        if (curr == bp) return true;
     }
+    return false;
+}
+#endif
 
-    size_t oldsz = get_hdr_size(oldptr);
-    if (adjust_block_size(newsz) < oldsz) { //try to reuse block
-        return oldptr;
-    } else { //try to see if merging with next free block is worthwhile
-        void *next_block = get_next_block(oldptr); 
-        if (get_curr_alloc(next_block) == FREE) {
-            size_t combinedsz = oldsz + get_hdr_size(next_block) + HDR_SIZE;
-            if (adjust_block_size(newsz) < combinedsz) {
-                set_prev_alloc(get_next_block(next_block), ALLOC);
-                set_hdr_size(oldptr, combinedsz);
-                write_footer(oldptr);
-                remove_free_list(next_block);       //remove the next block from list
-                return oldptr;
-            }
+/* Report Helper: report_segment
+ * -----------------------------
+ * Writes a row per block of one segment of arena idx and adds them to 
+ * the report's totals. Offsets count the arena's segments back to back,
+ * starting at base, the offset of this one. Caller must hold the lock. 
+ */
+static void report_segment(struct report *r, int idx, struct segment *seg, long long base)
+{
+    r->heap_bytes += seg->size;
+
+    char *bp = seg->base + FIRST_BLOCK;
+    for (size_t size = get_hdr_size(bp); size != 0; bp = get_next_block(bp), size = get_hdr_size(bp)) {
+        const char *state = "alloc";
+        if (get_curr_alloc(bp) == FREE) {
+            state = "free";
+            int bucket = get_bucket_num(size);
+            r->hist_count[bucket]++;
+            r->hist_bytes[bucket] += size;
+            r->free_blocks++;
+            r->free_bytes += size;
+            if (size > r->largest_free) r->largest_free = size;
+#if QUICKLIST
+        } else if (on_quick_list(&arenas[idx], bp)) {
+            state = "quick";
+            r->quick_blocks++;
+            r->quick_bytes += size;
+#endif
+        } else {
+            r->alloc_blocks++;
+            r->alloc_bytes += size;
+        }
+
+        long long offset = base + (bp - seg->base);
+        if (r->format == MYREPORT_CSV) {
+            report_row(r, state, idx, offset, size, -1);
+        } else {
+            report_printf(r, "%s\n{\"arena\":%d,\"offset\":%lld,\"size\":%zu,\"state\":\"%s\"}", 
+                          r->first_row ? "" : ",", idx, offset, size, state);
+            r->first_row = false;
         }
     }
+}
 
-    // Malloc a new block
-    void *newptr = mymalloc(newsz * REALLOC_MULT);
-    if (newptr == NULL) return NULL; 
-    memcpy(newptr, oldptr, oldsz < newsz ? oldsz: newsz);
-    myfree(oldptr);
-    return newptr;
+#if SLAB
+/* Report Helper: report_slabs
+ * ---------------------------
+ * Adds up, per class, the live slots in the slab pages of arena a and 
+ * the bytes they waste: what each live slot holds past its class's 
+ * (cls + 1) * SLAB_QUANTUM bytes, and what a page with live slots has 
+ * left after its last slot. Caller must hold the lock. 
+ */
+static void report_slabs(struct report *r, struct arena *a)
+{
+    size_t size = __atomic_load_n(&slab_seg.size, __ATOMIC_RELAXED);
+    for (size_t off = 0; off < size; off += PAGE_SIZE) {
+        struct slab *sl = (struct slab *)(slab_seg.base + off);
+        if (sl->arena != a || sl->nfree == sl->nslots) continue;
+        size_t slot = get_slot_size(sl->cls);
+        size_t live = sl->nslots - sl->nfree;
+        r->slab_slots[sl->cls] += live;
+        r->slab_waste[sl->cls] += live * (slot - (sl->cls + 1) * SLAB_QUANTUM) + 
+                                  PAGE_SIZE - SLAB_HDR_SZ - sl->nslots * slot;
+    }
 }
+#endif
 
-/**** **** ****         Testing Functions      **** **** ****/
+/* Report Helper: report_arena
+ * ---------------------------
+ * Walks every segment and slab page of one arena under its lock. 
+ */
+static void report_arena(struct report *r, int idx)
+{
+    struct arena *a = &arenas[idx];
+    pthread_mutex_lock(&a->lock);
+    long long base = 0;
+    for (int i = 0; i < a->nsegs; i++) {
+        report_segment(r, idx, &a->segs[i], base);
+        base += a->segs[i].size;
+    }
+#if SLAB
+    report_slabs(r, a);
+#endif
+    pthread_mutex_unlock(&a->lock);
+}
+
+/* Function: myheap_report
+ * -----------------------
+ * See allocator.h. The fragmentation index is printed with four decimal
+ * places using integer arithmetic, so no floating point formatting (which
+ * may allocate) is involved. 
+ */
+bool myheap_report(int fd, int format)
+{
+    struct report r;
+    memset(&r, 0, offsetof(struct report, buf));
+    r.fd = fd;
+    r.format = format;
+    r.ok = true;
+    r.first_row = true;
+
+    if (format == MYREPORT_CSV) report_printf(&r, "kind,arena,where,bytes,count\n");
+    else report_printf(&r, "{\"blocks\":[");
+    for (int i = 0; i < NARENAS; i++) {
+        if (arenas[i].segs[0].base != NULL) report_arena(&r, i);
+    }
+
+    // 1 - largest / total free, in ten-thousandths
+    unsigned long long frag = 0;
+    if (r.free_bytes > 0) frag = (unsigned long long)(r.free_bytes - r.largest_free) * 10000 / r.free_bytes;
+    size_t header_bytes = (r.alloc_blocks + r.quick_blocks) * HDR_SIZE;
+    size_t mapped = __atomic_load_n(&mapped_bytes, __ATOMIC_RELAXED);
+    size_t slab_bytes = __atomic_load_n(&slab_seg.size, __ATOMIC_RELAXED);
+
+    if (format == MYREPORT_CSV) {
+        for (int i = 0; i < NBUCKETS; i++) {
+            if (r.hist_count[i] > 0) report_row(&r, "bucket", -1, 1LL << (i + MIN_BLK_LOG2), r.hist_bytes[i], r.hist_count[i]);
+        }
+        for (int i = 0; i < NSLAB_CLASSES; i++) {
+            if (r.slab_slots[i] > 0) report_row(&r, "slab_waste", -1, get_slot_size(i), r.slab_waste[i], r.slab_slots[i]);
+        }
+        report_row(&r, "total_alloc", -1, -1, r.alloc_bytes, r.alloc_blocks);
+        report_row(&r, "total_free", -1, -1, r.free_bytes, r.free_blocks);
+        report_row(&r, "total_quick", -1, -1, r.quick_bytes, r.quick_blocks);
+        report_row(&r, "largest_free", -1, -1, r.largest_free, -1);
+        report_row(&r, "headers", -1, -1, header_bytes, r.alloc_blocks + r.quick_blocks);
+        report_row(&r, "heap", -1, -1, r.heap_bytes, -1);
+        report_row(&r, "slabs", -1, -1, slab_bytes, -1);
+        report_row(&r, "mapped", -1, -1, mapped, -1);
+        report_printf(&r, "fragmentation,,,%llu.%04llu,\n", frag / 10000, frag % 10000);
+    } else {
+        report_printf(&r, "\n],\n\"free_histogram\":[");
+        r.first_row = true;
+        for (int i = 0; i < NBUCKETS; i++) {
+            if (r.hist_count[i] == 0) continue;
+            report_printf(&r, "%s\n{\"bucket\":%d,\"min_size\":%llu,\"count\":%zu,\"bytes\":%zu}", 
+                          r.first_row ? "" : ",", i, 1ULL << (i + MIN_BLK_LOG2), r.hist_count[i], r.hist_bytes[i]);
+            r.first_row = false;
+        }
+        report_printf(&r, "\n],\n\"slab_waste\":[");
+        r.first_row = true;
+        for (int i = 0; i < NSLAB_CLASSES; i++) {
+            if (r.slab_slots[i] == 0) continue;
+            report_printf(&r, "%s\n{\"slot_size\":%zu,\"slots\":%zu,\"bytes\":%zu}", 
+                          r.first_row ? "" : ",", get_slot_size(i), r.slab_slots[i], r.slab_waste[i]);
+            r.first_row = false;
+        }
+        report_printf(&r, "\n],\n\"alloc_blocks\":%zu,\"alloc_bytes\":%zu,\n", r.alloc_blocks, r.alloc_bytes);
+        report_printf(&r, "\"free_blocks\":%zu,\"free_bytes\":%zu,\n", r.free_blocks, r.free_bytes);
+        report_printf(&r, "\"quick_blocks\":%zu,\"quick_bytes\":%zu,\n", r.quick_blocks, r.quick_bytes);
+        report_printf(&r, "\"largest_free\":%zu,\"fragmentation\":%llu.%04llu,\n", r.largest_free, frag / 10000, frag % 10000);
+        report_printf(&r, "\"header_bytes\":%zu,\n", header_bytes);
+        report_printf(&r, "\"heap_bytes\":%zu,\"slab_bytes\":%zu,\"mapped_bytes\":%zu}\n", r.heap_bytes, slab_bytes, mapped);
+    }
+    report_flush(&r);
+    return r.ok;
+}
+
+/* Function: myprofile_dump
+ * ------------------------
+ * See allocator.h. Stacks are written under the profiler's lock, which 
+ * samples and frees of sampled blocks wait on meanwhile; the mappings 
+ * are copied from /proc/self/maps afterwards. Like myheap_report, this 
+ * never allocates. 
+ */
+bool myprofile_dump(int fd)
+{
+#if PROFILE
+    struct report r;
+    memset(&r, 0, offsetof(struct report, buf));
+    r.fd = fd;
+    r.ok = true;
+
+    pthread_mutex_lock(&profile_lock);
+    if (profile_period == 0) {
+        pthread_mutex_unlock(&profile_lock);
+        return false;
+    }
+    size_t inuse_count = 0, inuse_bytes = 0, alloc_count = 0, alloc_bytes = 0;
+    for (size_t i = 0; i < PROFILE_STACKS; i++) {
+        inuse_count += profile_stacks[i].inuse_count;
+        inuse_bytes += profile_stacks[i].inuse_bytes;
+        alloc_count += profile_stacks[i].alloc_count;
+        alloc_bytes += profile_stacks[i].alloc_bytes;
+    }
+    report_printf(&r, "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu\n", 
+                  inuse_count, inuse_bytes, alloc_count, alloc_bytes, profile_period);
+    for (size_t i = 0; i < PROFILE_STACKS; i++) {
+        struct profile_stack *s = &profile_stacks[i];
+        if (s->hash == 0) continue;
+        report_printf(&r, "%zu: %zu [%zu: %zu] @", s->inuse_count, s->inuse_bytes, s->alloc_count, s->alloc_bytes);
+        for (int j = 0; j < s->depth; j++) report_printf(&r, " %#lx", (unsigned long)(uintptr_t)s->pc[j]);
+        report_printf(&r, "\n");
+    }
+    pthread_mutex_unlock(&profile_lock);
+
+    report_printf(&r, "\nMAPPED_LIBRARIES:\n");
+    report_flush(&r);
+    int maps = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+    if (maps < 0) return false;
+    ssize_t n = 0;
+    while (r.ok && (n = read(maps, r.buf, REPORT_BUF_SZ)) > 0) {
+        r.len = n;
+        report_flush(&r);
+    }
+    close(maps);
+    return r.ok && n == 0;
+#else
+    (void)fd;
+    return false;
+#endif
+}
 
 void print_bucket_count()
 {
     /*printf("{");
-    for (int i = 0; i < NBUCKETS; i++) {
+    for (int i = 0; i < NLISTS; i++) {
         int count = 0;        
-        for (void *curr_free = free_list[i]; curr_free != NULL; curr_free = get_next(curr_free)) {
+        for (void *curr_free = arenas[0].free_list[i]; curr_free != NULL; curr_free = get_next(&arenas[0], curr_free)) {
             if (curr_free != NULL) {
                 count++;
             } 
         }
 
         printf("%d", count);
-        if (i != NBUCKETS - 1) printf(", ");
+        if (i != NLISTS - 1) printf(", ");
     }
     printf("}\n");*/
 }
 
 void print_free_lists()
 {
-    /*for (int i = 0; i < NBUCKETS; i++) {
-        void *curr_free = free_list[i]; 
+    /*for (int i = 0; i < NLISTS; i++) {
+        void *curr_free = arenas[0].free_list[i]; 
         int block_count = 0;
 
         if (curr_free != NULL) {
@@ -715,7 +4250,7 @@ void print_free_lists()
                 printf("\n Free [%d] #%d (%s) - Size: %d Bytes - %#08x", i, block_count, curr_str, size, (unsigned int) curr_free);
 
                 block_count++;
-                curr_free = get_next(curr_free);
+                curr_free = get_next(&arenas[0], curr_free);
             }
 
             printf("\n----------------------------------------------\n");
@@ -728,9 +4263,9 @@ void print_free_lists()
 
 void print_entire_heap()
 {
-    /*void *curr_block = (char *)heap_start + HDR_FTR_SIZE; 
+    /*void *curr_block = arenas[0].segs[0].base + HDR_FTR_SIZE; 
     int block_counter = 0;
-    printf("Number of Pages: %d\n", heap_segment_size() / PAGE_SIZE);
+    printf("Number of Pages: %d\n", arenas[0].segs[0].size / PAGE_SIZE);
     while (true) {
         int size = get_hdr_size(curr_block);
         int curr_alloc = get_curr_alloc(curr_block);
@@ -773,25 +4308,267 @@ void print_entire_heap()
 }
 
 
-/* Function: validate_heap 
- * -------------------
- * My validate heap function doesn't "validate" (sorry!) the heap so much as 
- * it has allowed me to examine the contents of the heap and manually check that
- * my segregated bucket lists, free lists, and bytes of the heap are
- * what I expect them to be when I print them out (and find out what 
- * went wrong when it does). It has proved pretty invaluable. 
- * 
+/* Check Helper: heap_error
+ * ------------------------
+ * Reports a broken invariant of arena a on stderr and returns false. 
+ * The line is formatted on the stack, since the heap may be what is 
+ * broken. 
  */
-bool validate_heap()
-{ 
-    // Check the get_bucket_num function for various sizes.
-    /*for (int i = 12; i <= 10000000; i++) {
-        printf("Size: %d -> Bucket: %d\n", i, get_bucket_num(i));
-    }*/
+__attribute__((format(printf, 3, 4)))
+static bool heap_error(struct arena *a, void *bp, const char *fmt, ...)
+{
+    char line[REPORT_LINE_MAX];
+    int n = snprintf(line, sizeof(line), "validate_heap: arena %d, block %p: ", (int)(a - arenas), bp);
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(line + n, sizeof(line) - n - 1, fmt, ap);
+    va_end(ap);
+    n = strlen(line);
+    line[n++] = '\n';
+    ssize_t written = write(STDERR_FILENO, line, n);
+    (void)written;      //nowhere left to report a failed write
+    return false;
+}
+
+/* Check Helper: in_arena
+ * ----------------------
+ * Whether bp lies in one of the segments of arena a, past the arena 
+ * pointer at its base, so that its header may be read. 
+ */
+static bool in_arena(struct arena *a, void *bp)
+{
+    for (int i = 0; i < a->nsegs; i++) {
+        struct segment *seg = &a->segs[i];
+        if ((char *)bp >= seg->base + FIRST_BLOCK && (char *)bp < seg->base + seg->size) return true;
+    }
+    return false;
+}
+
+/* Check Helper: check_block
+ * -------------------------
+ * Checks one block of a segment walk: alignment, a size that stays in 
+ * the segment, the prev_alloc bit against the block before, and for a 
+ * free block a matching footer, no free block before it, and zeros from
+ * its zero_from offset up to its release mark. 
+ */
+static bool check_block(struct arena *a, void *bp, char *end, int prev_alloc)
+{
+    size_t size = get_hdr_size(bp);
+    if ((uintptr_t)bp % ALIGNMENT != 0 || size < MIN_BLK_SZ || (size + HDR_SIZE) % ALIGNMENT != 0) {
+        return heap_error(a, bp, "misaligned or undersized (%zu bytes)", size);
+    }
+    if (size > (size_t)(end - (char *)bp) - HDR_SIZE) return heap_error(a, bp, "runs past its segment");
+    if (get_prev_alloc(bp) != prev_alloc) return heap_error(a, bp, "prev_alloc bit does not match the block before");
+    if (get_curr_alloc(bp) == ALLOC) return true;
+
+    if (prev_alloc == FREE) return heap_error(a, bp, "follows another free block");
+    void *ftr = get_ftr_addr(bp);
+    if (get_size(ftr) != size || (get(ftr) & 0x1) != FREE) return heap_error(a, bp, "footer does not match its header");
+
+    size_t zero_from = get_zero_from(bp);
+    if (zero_from == 0) return true;
+    if (zero_from < ZERO_MIN || zero_from % sizeof(size_t) != 0) return heap_error(a, bp, "bad zero_from %zu", zero_from);
+    size_t *mark = (size_t *)ftr - 1;
+    for (size_t *w = (size_t *)((char *)bp + zero_from); w < mark; w++) {
+        if (*w != 0) return heap_error(a, bp, "nonzero word at offset %zu past zero_from %zu", 
+                                       (size_t)((char *)w - (char *)bp), zero_from);
+    }
+    return true;
+}
+
+/* Check Helper: check_segment
+ * ---------------------------
+ * Walks the blocks of one segment of arena a, from the first block to 
+ * the epilogue, which must end the segment, and counts the free ones. 
+ */
+static bool check_segment(struct arena *a, struct segment *seg, size_t *nfree)
+{
+    if (*(struct arena **)seg->base != a) return heap_error(a, seg->base, "segment does not point back at its arena");
+    char *end = seg->base + seg->size;
+    char *bp = seg->base + FIRST_BLOCK;
+    int prev_alloc = ALLOC;
+    while (get_hdr_size(bp) != 0) {
+        if (!check_block(a, bp, end, prev_alloc)) return false;
+        prev_alloc = get_curr_alloc(bp);
+        if (prev_alloc == FREE) (*nfree)++;
+        bp = get_next_block(bp);
+    }
+    if (bp != end || get_curr_alloc(bp) != ALLOC) return heap_error(a, bp, "epilogue is not at the end of its segment");
+    if (get_prev_alloc(bp) != prev_alloc) return heap_error(a, bp, "epilogue's prev_alloc bit does not match");
+    return true;
+}
+
+/* Check Helper: check_lists
+ * -------------------------
+ * Walks every free list of arena a, checking that each node is a free
+ * block of the arena filed on the right list with a back link to the 
+ * node before it, and that the first nodes match the list's FIT_CACHE 
+ * candidates and each list's TLSF bits its state. Adds the nodes to 
+ * listed, stopping at more than nfree so that a cycle cannot hang it. 
+ */
+static bool check_lists(struct arena *a, size_t nfree, size_t *listed)
+{
+    for (int i = 0; i < NLISTS; i++) {
+        size_t n = 0;
+        void *prev = NULL;
+        for (void *bp = a->free_list[i]; bp != NULL; prev = bp, bp = get_next(a, bp), n++) {
+            if (*listed + n >= nfree) return heap_error(a, bp, "more nodes on the free lists than free blocks");
+            if (!in_arena(a, bp) || get_curr_alloc(bp) != FREE) return heap_error(a, bp, "on list %d but not free in this arena", i);
+            size_t size = get_hdr_size(bp);
+            if (get_list_num(size) != i) return heap_error(a, bp, "on list %d but sized for list %d", i, get_list_num(size));
+#if SIZE_TREE
+            if (size >= TREE_MIN) return heap_error(a, bp, "on list %d but sized for the size tree", i);
+#endif
+            void *expect = prev;
+#if !COMPACT_LINKS
+            if (prev == NULL) expect = &a->free_list[i];
+#endif
+            if (get_prev(a, bp) != expect) return heap_error(a, bp, "back link on list %d does not name the node before", i);
+#if FIT_CACHE
+            if ((int)n < a->fit_count[i]) {
+                int j = fit_slot(a, i, n);
+                if (a->fit_blk[i][j] != bp || a->fit_size[i][j] != fit_key(size)) {
+                    return heap_error(a, bp, "node %zu of list %d differs from its FIT_CACHE candidate", n, i);
+                }
+            }
+#endif
+        }
+#if FIT_CACHE
+        if (i < LIST_BUCKETS && a->fit_count[i] > n) return heap_error(a, NULL, "list %d has fewer nodes than FIT_CACHE candidates", i);
+#endif
+#if TLSF
+        bool bit = (a->sl_bitmap[i / SL_COUNT] >> (i % SL_COUNT)) & 1;
+        if (bit != (n > 0)) return heap_error(a, NULL, "second-level bit of list %d is %d", i, bit);
+#endif
+        *listed += n;
+    }
+#if TLSF
+    for (int fl = 0; fl < FL_COUNT; fl++) {
+        bool bit = (a->fl_bitmap >> fl) & 1;
+        if (bit != (a->sl_bitmap[fl] != 0)) return heap_error(a, NULL, "first-level bit %d is %d", fl, bit);
+    }
+#endif
+    return true;
+}
+
+#if SIZE_TREE
+/* Check Helper: check_tree
+ * ------------------------
+ * Checks the subtree at node of arena a's size tree: every node a free
+ * block of the arena of at least TREE_MIN bytes, ordered by key between
+ * the nodes lo and hi (NULL for no bound), and not outranking its 
+ * parent. Counts nodes into listed, stopping past nfree. 
+ */
+static bool check_tree(struct arena *a, void *node, void *parent, void *lo, void *hi, 
+                       size_t nfree, size_t *listed)
+{
+    if (node == NULL) return true;
+    if (++*listed > nfree) return heap_error(a, node, "more nodes in the size tree than free blocks");
+    if (!in_arena(a, node) || get_curr_alloc(node) != FREE) return heap_error(a, node, "in the size tree but not free in this arena");
+    size_t size = get_hdr_size(node);
+    if (size < TREE_MIN) return heap_error(a, node, "in the size tree but below TREE_MIN");
+    if ((lo != NULL && !tree_less(get_hdr_size(lo), lo, node)) || (hi != NULL && !tree_less(size, node, hi))) {
+        return heap_error(a, node, "out of order in the size tree");
+    }
+    if (parent != NULL && tree_priority(node) > tree_priority(parent)) return heap_error(a, node, "outranks its parent in the size tree");
+    return check_tree(a, *tree_left(node), node, lo, node, nfree, listed) && 
+           check_tree(a, *tree_right(node), node, node, hi, nfree, listed);
+}
+#endif
 
-    //print_bucket_count();
-    //print_free_lists();
-    //print_entire_heap();
+#if QUICKLIST
+/* Check Helper: check_quick
+ * -------------------------
+ * Checks that each quick list of arena a holds as many blocks as it 
+ * counts, all allocated-looking blocks of the arena of its size. 
+ */
+static bool check_quick(struct arena *a)
+{
+    int total = 0;
+    for (int i = 0; i < QUICK_NCLASSES; i++) {
+        int n = 0;
+        for (void *bp = a->quick[i]; bp != NULL; bp = get_stack_next(bp)) {
+            if (++n > a->quick_count[i]) return heap_error(a, bp, "quick list %d is longer than its count", i);
+            if (!in_arena(a, bp) || get_curr_alloc(bp) != ALLOC || 
+                get_hdr_size(bp) != MIN_BLK_SZ + ((size_t)i << ALIGN_LOG2)) {
+                return heap_error(a, bp, "on quick list %d but not an allocated block of its size", i);
+            }
+        }
+        if (n != a->quick_count[i]) return heap_error(a, NULL, "quick list %d is shorter than its count", i);
+        total += n;
+    }
+    if (total != a->quick_total) return heap_error(a, NULL, "quick lists hold %d blocks, not %d", total, a->quick_total);
+    return true;
+}
+#endif
 
+#if SLAB
+/* Check Helper: check_slabs
+ * -------------------------
+ * Checks that each of arena a's lists of slabs with free slots holds 
+ * pages of the slab range owned by the arena, of the list's class, 
+ * linked both ways, with a free count that matches the bitmap and lies
+ * between 1 and the number of slots. 
+ */
+static bool check_slabs(struct arena *a)
+{
+    size_t npages = __atomic_load_n(&slab_seg.size, __ATOMIC_RELAXED) / PAGE_SIZE;
+    for (int cls = 0; cls < NSLAB_CLASSES; cls++) {
+        size_t n = 0;
+        struct slab *prev = NULL;
+        for (struct slab *sl = a->slabs[cls]; sl != NULL; prev = sl, sl = sl->next) {
+            if (++n > npages || !is_slab(sl) || (uintptr_t)sl % PAGE_SIZE != 0) {
+                return heap_error(a, sl, "slab list %d holds a page outside the slab range", cls);
+            }
+            int nfree = 0;
+            for (int w = 0; w < SLAB_BITMAP_WORDS; w++) nfree += __builtin_popcountl(sl->bitmap[w]);
+            if (sl->arena != a || sl->cls != cls || sl->prev != prev) {
+                return heap_error(a, sl, "slab list %d holds a page of another list", cls);
+            }
+            if (sl->nfree != nfree || nfree == 0 || nfree > sl->nslots) {
+                return heap_error(a, sl, "slab counts %d of %d slots free, bitmap %d", sl->nfree, sl->nslots, nfree);
+            }
+        }
+    }
     return true;
-}
\ No newline at end of file
+}
+#endif
+
+/* Function: validate_heap 
+ * -----------------------
+ * Checks every arena under its lock: the blocks of each segment (see 
+ * check_block), the free lists, size tree and TLSF bitmaps against the
+ * free blocks found, the quick lists and the slab lists. Describes the 
+ * first problem found on stderr. Blocks in thread caches or queued as 
+ * remote frees look allocated, and are checked as such, but no block 
+ * may stay queued on an arena once its last thread has detached. 
+ */
+bool validate_heap()
+{ 
+    bool ok = true;
+    for (int i = 0; i < NARENAS && ok; i++) {
+        struct arena *a = &arenas[i];
+        if (a->segs[0].base == NULL) continue;
+        pthread_mutex_lock(&a->lock);
+        size_t nfree = 0, listed = 0;
+        for (int j = 0; j < a->nsegs && ok; j++) ok = check_segment(a, &a->segs[j], &nfree);
+        if (ok) ok = check_lists(a, nfree, &listed);
+#if SIZE_TREE
+        if (ok) ok = check_tree(a, a->size_tree, NULL, NULL, NULL, nfree, &listed);
+#endif
+        if (ok && listed != nfree) ok = heap_error(a, NULL, "%zu free blocks, %zu filed", nfree, listed);
+#if QUICKLIST
+        if (ok) ok = check_quick(a);
+#endif
+#if SLAB
+        if (ok) ok = check_slabs(a);
+#endif
+#if REMOTE_FREE
+        if (ok && a->nthreads == 0 && a->remote != NULL) {
+            ok = heap_error(a, NULL, "remote frees queued with no thread attached");
+        }
+#endif
+        pthread_mutex_unlock(&a->lock);
+    }
+    return ok;
+}
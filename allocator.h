@@ -34,6 +34,24 @@ void *mymalloc(size_t size);
 void *myrealloc(void *ptr, size_t size);
 
 
+/* Function: mycalloc
+ * ------------------
+ * Custom version of calloc. Memory known to be zero (fresh from the
+ * OS or released back to it) is not cleared again.
+ */
+void *mycalloc(size_t nmemb, size_t size);
+
+
+/* Function: myrealloc_inplace
+ * ---------------------------
+ * Try-only realloc: resizes the block without allocating a new one,
+ * growing into free neighbors or the end of the heap. The block may
+ * move down into a free block just before it. Returns the resized
+ * block, or NULL if that is not possible (the block is left as is).
+ */
+void *myrealloc_inplace(void *ptr, size_t size);
+
+
 /* Function: myfree
  * ----------------
  * Custom version of free.
@@ -41,10 +59,188 @@ void *myrealloc(void *ptr, size_t size);
 void myfree(void *ptr);
 
 
+/* Function: myaligned_alloc, myposix_memalign
+ * -------------------------------------------
+ * Custom versions of aligned_alloc and posix_memalign. The alignment
+ * must be a power of two (and, for myposix_memalign, a multiple of
+ * sizeof(void *)). The block is freed with myfree as usual.
+ */
+void *myaligned_alloc(size_t alignment, size_t size);
+int myposix_memalign(void **memptr, size_t alignment, size_t size);
+
+
+/* Function: mymalloc_batch, myfree_batch
+ * ---------------------------------------
+ * Allocate or free many blocks with one call. mymalloc_batch stores n
+ * blocks of size bytes in out and returns how many it allocated (fewer 
+ * than n only if memory ran out). myfree_batch frees n pointers and 
+ * reorders the ptrs array while doing so. 
+ */
+size_t mymalloc_batch(size_t size, size_t n, void **out);
+void myfree_batch(void **ptrs, size_t n);
+
+
+/* Function: myusable_size
+ * ------------------------
+ * Returns the number of usable bytes in a block from mymalloc (0 for
+ * NULL), which may exceed the size requested.
+ */
+size_t myusable_size(void *ptr);
+
+
+/* Function: mylock_all, myunlock_all, myfork_child
+ * ------------------------------------------------
+ * Acquire and release every allocator lock. Meant for pthread_atfork
+ * handlers (mylock_all before fork, myunlock_all in the parent and
+ * myfork_child in the child) so that a forked child starts with a
+ * consistent heap. myfork_child also forgets the threads and the
+ * scavenger that did not survive the fork.
+ */
+void mylock_all(void);
+void myunlock_all(void);
+void myfork_child(void);
+
+
+/* Function: myfootprint
+ * ---------------------
+ * Returns the number of bytes the allocator currently holds from the
+ * OS (heap segments, slab pages and mapped blocks). Dividing the peak
+ * payload by this gives the heap utilization.
+ */
+size_t myfootprint(void);
+
+
+/* Struct: mystats
+ * ---------------
+ * Counters filled in by mystats. Coalesces are split by the state of 
+ * the neighbors (AFA, AFF, FFA, FFF), fit_examined counts free-list 
+ * nodes visited per bucket by the fit search, cutoff_hits counts 
+ * buckets abandoned at the search cutoff, and fit_cache_hits counts fits
+ * found among the nodes mirrored with FIT_CACHE. 
+ */
+#define MYSTATS_NBUCKETS 64
+
+struct mystats {
+    size_t bytes_in_use;        //usable bytes of blocks handed out
+    size_t bytes_mapped;        //bytes held from the OS (see myfootprint)
+    unsigned long extend_calls; //segment extensions and new segments
+    unsigned long splits;       //free blocks split by malloc
+    unsigned long coalesce[4];  //frees by case: AFA, AFF, FFA, FFF
+    unsigned long fit_examined[MYSTATS_NBUCKETS];
+    unsigned long cutoff_hits;
+    unsigned long fit_cache_hits;
+    unsigned long realloc_reuse;    //realloc kept the block as is
+    unsigned long realloc_merge;    //realloc absorbed the next free block
+    unsigned long realloc_extend;   //realloc grew the block past the heap tail
+    unsigned long realloc_prev;     //realloc moved down into the previous free block
+    unsigned long realloc_remap;    //realloc resized a mapped block
+    unsigned long realloc_copy;     //realloc moved to a new block
+    unsigned long quick_hits;       //mallocs served from a quick list
+    unsigned long consolidations;   //times all quick lists were coalesced
+    unsigned long remote_frees;     //blocks queued by threads of other arenas
+    unsigned long remote_drains;    //times a queue of remote frees was emptied
+};
+
+/* Function: mystats
+ * -----------------
+ * Fills st with the counters gathered since the last myinit. Returns 
+ * false if the allocator was built without -DSTATS=1, in which case 
+ * only bytes_mapped is filled in. 
+ */
+bool mystats(struct mystats *st);
+
+
+/* Function: mytrim
+ * ----------------
+ * Hands the free pages of every arena back to the OS right away
+ * instead of waiting for the decay policy. 
+ */
+void mytrim(void);
+
+
+/* Function: myscavenge_start, myscavenge_stop
+ * -------------------------------------------
+ * Start or stop an optional background thread that releases free pages
+ * every interval_ms once they have decayed, so that idle processes give
+ * memory back without another call to myfree. 
+ */
+bool myscavenge_start(unsigned int interval_ms);
+void myscavenge_stop(void);
+
+
+/* Function: myheap_report
+ * -----------------------
+ * Walks every arena and writes a heap map to the file descriptor fd:
+ * each block's arena, offset, size and state (alloc, free, or quick for
+ * a block parked uncoalesced on a quick list), a histogram of free
+ * blocks per bucket, the largest free block, the external fragmentation
+ * index (1 - largest free / total free), the bytes spent on headers,
+ * and per slab class the slots in use and the bytes lost to rounding
+ * (slots rounded up past their class size and page ends no slot fits
+ * in). Blocks held in thread caches or queued as remote frees show as
+ * alloc.
+ * format is MYREPORT_JSON or MYREPORT_CSV. Each arena is walked under
+ * its lock and nothing is allocated, so it may be called at any point
+ * on a live heap. Returns false if a write fails.
+ */
+#define MYREPORT_JSON   0
+#define MYREPORT_CSV    1
+
+bool myheap_report(int fd, int format);
+
+
+/* Function: myprofile_start, myprofile_stop, myprofile_dump, myprofile_signal
+ * ---------------------------------------------------------------------------
+ * A sampling heap profiler. While started, each thread records the call 
+ * stack of about one allocation per sample_bytes bytes it allocates (the
+ * gaps are drawn at random, so every byte is equally likely to be 
+ * sampled) and follows each sampled block until it is freed. Starting 
+ * discards earlier samples; stopping takes no more, but keeps following
+ * the blocks already sampled. Returns false if the allocator was built 
+ * with -DPROFILE=0. 
+ * myprofile_dump writes the samples to fd in the heap profile format of
+ * gperftools, which pprof reads (pprof -sample_index=inuse_space or 
+ * alloc_space): per stack, the sampled blocks still in use and all that 
+ * were allocated, with the sampling rate so pprof can scale them back 
+ * up, then the process's mappings for symbolizing. It does not allocate.
+ * Returns false if the profiler never started or a write fails. 
+ * myprofile_signal makes signo dump a profile to PREFIX.PID.SEQ.heap, 
+ * from a thread it starts, rather than the handler. 
+ */
+bool myprofile_start(size_t sample_bytes);
+void myprofile_stop(void);
+bool myprofile_dump(int fd);
+bool myprofile_signal(int signo, const char *prefix);
+
+
+/* Function: myregion_create, myregion_alloc, myregion_reset, myregion_destroy
+ * ---------------------------------------------------------------------------
+ * Regions serve many short-lived blocks that die together. myregion_alloc 
+ * bumps a pointer through chunks of REGION_CHUNK bytes taken from the heap,
+ * so blocks carry no headers and are never freed one by one: they must 
+ * not be passed to myfree or myrealloc. Requests over REGION_CHUNK / 4 
+ * get a heap block of their own. myregion_reset frees all of a region's 
+ * blocks at once but keeps its chunks for the next round; 
+ * myregion_destroy gives the chunks back too. Blocks are aligned like 
+ * mymalloc's. A region is not thread-safe: one thread at a time may use 
+ * it. myregion_create and myregion_alloc return NULL when memory runs
+ * out (and myregion_alloc for size 0).
+ */
+struct myregion;
+
+struct myregion *myregion_create(void);
+void *myregion_alloc(struct myregion *r, size_t size);
+void myregion_reset(struct myregion *r);
+void myregion_destroy(struct myregion *r);
+
+
 /* Function: validate_heap
  * -----------------------
  * This is the hook for your heap consistency checker. Returns true
- * if all is well, false on any problem.
+ * if all is well, false on any problem, which it describes on stderr.
+ * Checks each arena under its lock, so it may run while other threads
+ * use the heap, and reports remote frees left queued on an arena that 
+ * no thread is attached to (a free still in flight may do so briefly).
  */
 bool validate_heap(void);
 
@@ -0,0 +1,110 @@
+#!/usr/bin/env python3
+#
+# File: autotune.py
+# -----------------
+# Sweeps the tuning knobs of allocator.c over a trace corpus. Writes a grid
+# of policies to variants/policies.mk, builds them all with `make variants`,
+# replays the traces against each variant and prints, per trace and for the
+# average, the Pareto front of utilization against throughput: the variants
+# that no other variant beats on both.
+#
+#     python3 autotune.py [-j jobs] [-n reps] [--arch 64] [trace ...]
+#
+# Traces default to traces/*.script. Edit GRID to change what is swept;
+# knobs left out keep their defaults in allocator.c.
+#
+import argparse
+import glob
+import itertools
+import os
+import subprocess
+import sys
+
+# Values tried for each knob. Cutoffs only matter to the search they bound,
+# so the fit and its cutoff are swept together.
+FITS = [("first", {"BEST1_FIRST0": 0, "BUCKET_CUTOFF": c}) for c in (2, 5, 10, 20)] + \
+       [("best", {"BEST1_FIRST0": 1, "BEST_FIT_CUTOFF": c}) for c in (5, 15, 40)]
+GRID = {
+    "SPLIT_FREE_FIRST": [1, 0],
+    "REALLOC_MULT": [1, 2],
+    "INIT_NPAGES": [3, 16],
+}
+
+
+def policies():
+    """Yields (name, {knob: value}) for every point of the grid."""
+    keys = sorted(GRID)
+    for fit_name, fit in FITS:
+        for values in itertools.product(*(GRID[k] for k in keys)):
+            knobs = dict(fit, **dict(zip(keys, values)))
+            cutoff = knobs.get("BUCKET_CUTOFF", knobs.get("BEST_FIT_CUTOFF"))
+            tags = ["%s%d" % (k[0].lower(), v) for k, v in zip(keys, values)]
+            name = "-".join(["%s%d" % (fit_name, cutoff)] + tags)
+            yield name, knobs
+
+
+def flags(knobs):
+    return " ".join("-D%s=%d" % kv for kv in sorted(knobs.items()))
+
+
+def build(grid, args):
+    os.makedirs("variants", exist_ok=True)
+    with open("variants/policies.mk", "w") as f:
+        f.write("# Generated by autotune.py\n")
+        for name, knobs in grid:
+            f.write("POLICY_%s = %s\n" % (name, flags(knobs)))
+    cmd = ["make", "-j%d" % args.jobs, "variants"]
+    if args.arch:
+        cmd.append("ARCH=%s" % args.arch)
+    subprocess.run(cmd, check=True, stdout=subprocess.DEVNULL)
+
+
+def measure(name, args):
+    """Returns {trace: (util, kops)} for one variant, with "average" too."""
+    out = subprocess.run(["./variants/replay-" + name, "-n", str(args.reps), "-a", "mymalloc"]
+                         + args.traces, check=True, capture_output=True, text=True).stdout
+    results = {}
+    for line in out.splitlines():
+        cols = line.split()
+        if len(cols) >= 4 and cols[1] == "mymalloc":
+            results[cols[0]] = (float(cols[2].rstrip("%")), float(cols[3]))
+    return results
+
+
+def pareto(points):
+    """Keeps the (name, util, kops) points no other point dominates."""
+    front = []
+    for p in points:
+        if not any(q[1] >= p[1] and q[2] >= p[2] and (q[1], q[2]) != (p[1], p[2]) for q in points):
+            front.append(p)
+    return sorted(front, key=lambda p: (-p[1], -p[2]))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Sweep allocator policies over traces")
+    parser.add_argument("-j", "--jobs", type=int, default=os.cpu_count() or 1)
+    parser.add_argument("-n", "--reps", type=int, default=5, help="throughput passes per trace")
+    parser.add_argument("--arch", help="passed to make as ARCH (32 or 64)")
+    parser.add_argument("traces", nargs="*")
+    args = parser.parse_args()
+    args.traces = args.traces or sorted(glob.glob("traces/*.script"))
+
+    grid = list(policies())
+    build(grid, args)
+    results = {}
+    for i, (name, _) in enumerate(grid):
+        print("measuring %s (%d/%d)" % (name, i + 1, len(grid)), file=sys.stderr)
+        results[name] = measure(name, args)
+
+    knobs = dict(grid)
+    traces = [os.path.basename(t) for t in args.traces] + ["average"]
+    for trace in traces:
+        points = [(name, r[trace][0], r[trace][1]) for name, r in results.items() if trace in r]
+        print("\n%s" % trace)
+        print("  %-24s %7s %10s  %s" % ("variant", "util", "Kops/s", "flags"))
+        for name, util, kops in pareto(points):
+            print("  %-24s %6.1f%% %10.1f  %s" % (name, util, kops, flags(knobs[name])))
+
+
+if __name__ == "__main__":
+    main()
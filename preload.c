@@ -0,0 +1,156 @@
+/* File: preload.c
+ * ---------------
+ * Drop-in replacement for the C library allocator, built by the Makefile
+ * as libmymalloc.so. Run any dynamically linked program on top of this
+ * allocator with
+ *
+ *      LD_PRELOAD=./libmymalloc.so program args...
+ *
+ * Every entry point initializes the heap on first use, so nothing needs
+ * to call myinit. The C library's own allocations (stdio buffers,
+ * strdup, thread stacks' bookkeeping) land here too.
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "allocator.h"
+
+static pthread_once_t boot_once = PTHREAD_ONCE_INIT;
+static bool booted;
+
+static void boot(void)
+{
+    __atomic_store_n(&booted, myinit(), __ATOMIC_RELEASE);
+}
+
+/* Function: ensure_init
+ * ---------------------
+ * Sets up the heap the first time any entry point runs. Returns false
+ * if the heap could not be reserved.
+ */
+static inline bool ensure_init(void)
+{
+    if (__atomic_load_n(&booted, __ATOMIC_ACQUIRE)) return true;
+    pthread_once(&boot_once, boot);
+    return __atomic_load_n(&booted, __ATOMIC_ACQUIRE);
+}
+
+/* Function: start_profile
+ * -----------------------
+ * Starts the heap profiler if MYMALLOC_PROFILE names a sampling rate in
+ * bytes. Profiles are dumped to MYMALLOC_PROFILE_PREFIX.PID.SEQ.heap
+ * (prefix "mymalloc" by default) whenever the process receives signal
+ * MYMALLOC_PROFILE_SIGNAL (SIGUSR2 by default).
+ */
+static void start_profile(void)
+{
+    const char *rate = getenv("MYMALLOC_PROFILE");
+    if (rate == NULL || !myprofile_start(strtoul(rate, NULL, 0))) return;
+    const char *signo = getenv("MYMALLOC_PROFILE_SIGNAL");
+    const char *prefix = getenv("MYMALLOC_PROFILE_PREFIX");
+    myprofile_signal(signo != NULL ? atoi(signo) : SIGUSR2, prefix != NULL ? prefix : "mymalloc");
+}
+
+/* Function: install
+ * -----------------
+ * Runs when the library is loaded: boots the heap, registers the fork
+ * handlers and starts the profiler if asked to, none of which may happen
+ * from inside the first malloc.
+ */
+__attribute__((constructor)) static void install(void)
+{
+    if (!ensure_init()) return;
+    pthread_atfork(mylock_all, myunlock_all, myfork_child);
+    start_profile();
+}
+
+/* Function: nomem
+ * ---------------
+ * Sets errno the way the C library does when an allocation fails.
+ */
+static inline void *nomem(void *ptr)
+{
+    if (ptr == NULL) errno = ENOMEM;
+    return ptr;
+}
+
+// malloc(0) must return a unique pointer rather than NULL, so zero-byte
+// requests get the smallest block instead
+void *malloc(size_t size)
+{
+    if (!ensure_init()) return nomem(NULL);
+    return nomem(mymalloc(size ? size : 1));
+}
+
+void free(void *ptr)
+{
+    if (ptr != NULL) myfree(ptr);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    size_t total;
+    if (__builtin_mul_overflow(nmemb, size, &total)) return nomem(NULL);
+    if (!ensure_init()) return nomem(NULL);
+    return nomem(mycalloc(total ? total : 1, 1));
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    if (ptr == NULL) return malloc(size);
+    if (size == 0) {
+        myfree(ptr);
+        return NULL;
+    }
+    return nomem(myrealloc(ptr, size));
+}
+
+void *reallocarray(void *ptr, size_t nmemb, size_t size)
+{
+    size_t total;
+    if (__builtin_mul_overflow(nmemb, size, &total)) return nomem(NULL);
+    return realloc(ptr, total);
+}
+
+size_t malloc_usable_size(void *ptr)
+{
+    return myusable_size(ptr);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    if (!ensure_init()) return ENOMEM;
+    return myposix_memalign(memptr, alignment, size ? size : 1);
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    if (!ensure_init()) return nomem(NULL);
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return nomem(myaligned_alloc(alignment, size ? size : 1));
+}
+
+// Obsolete variants that the C library still exports; a program that
+// calls them must not reach the C library's own heap
+void *memalign(size_t alignment, size_t size)
+{
+    return aligned_alloc(alignment, size);
+}
+
+void *valloc(size_t size)
+{
+    return aligned_alloc(sysconf(_SC_PAGESIZE), size);
+}
+
+void *pvalloc(size_t size)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    return aligned_alloc(page, (size + page - 1) & ~(page - 1));
+}
@@ -0,0 +1,715 @@
+/* File: replay.c
+ * --------------
+ * Standalone trace-replay benchmark. Replays allocation scripts against
+ * mymalloc/myrealloc/myfree and against the system malloc, and reports
+ * for each script the peak heap utilization, the throughput in
+ * operations per second and percentiles of the per-operation latency.
+ *
+ * Usage: replay [-n reps] [-a allocator] [-t] [-v] script ...
+ *
+ * -n sets the number of throughput passes and -a measures only the named
+ * allocator (mymalloc or libc). -t also reports, over the throughput 
+ * passes, the data TLB load misses per request (where the CPU and kernel 
+ * let perf_event_open count them, "-" otherwise) and the minor page 
+ * faults per pass. -v runs the allocator's heap checker (validate_heap 
+ * for mymalloc) after every request of the checked pass, and adds a 
+ * second checked pass in which another thread makes every free, so that
+ * they reach the heap as remote frees. 
+ *
+ * A script is one request per line: "a id size" allocates, "r id size"
+ * reallocates and "f id" frees the block named by id. Blank lines and
+ * lines starting with '#' are skipped. Blocks still live at the end of
+ * a script are freed before the next pass.
+ *
+ * Each measurement runs in a forked child so that every allocator starts
+ * from a pristine process heap, and the harness keeps its own memory
+ * out of malloc so it never shows up in the system malloc's footprint.
+ */
+#include <inttypes.h>
+#include <limits.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "allocator.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TICK_UNIT "cyc"
+static inline uint64_t ticks(void) { return __rdtsc(); }
+#else
+#define TICK_UNIT "ns"
+static inline uint64_t ticks(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+#endif
+
+#define DEFAULT_REPS 20
+
+// Strictest alignment a block is checked for; build with -DREPLAY_ALIGN=8
+// against an allocator built with COMPACT_LINKS
+#ifndef REPLAY_ALIGN
+#define REPLAY_ALIGN (2 * sizeof(void *))
+#endif
+
+struct op {
+    char type;              // 'a', 'r' or 'f'
+    int id;                 // block named by the request
+    size_t size;            // requested size (unused for 'f')
+};
+
+struct trace {
+    const char *name;
+    struct op *ops;
+    int nops;
+    int nids;               // one more than the largest id
+};
+
+struct allocator {
+    const char *name;
+    bool (*init)(void);
+    void *(*malloc)(size_t);
+    void *(*realloc)(void *, size_t);
+    void (*free)(void *);
+    size_t (*footprint)(void);
+    bool (*validate)(void);     // heap checker, or NULL if there is none
+};
+
+struct result {
+    double util;            // peak payload / peak footprint
+    double ops_per_sec;
+    uint64_t p50, p90, p99, p999, max;
+    double tlb_misses;      // dTLB load misses per request (-1 if not counted)
+    double faults;          // minor page faults per pass
+};
+
+// Per-pass state, sized for the largest trace
+static void **blocks;
+static size_t *sizes;
+static uint64_t *lat;
+static bool count_tlb;      // -t: count TLB misses and page faults
+static bool validate;       // -v: check the heap after every request
+
+
+/**** **** ****       System Malloc Functions      **** **** ****/
+
+static size_t libc_baseline;
+
+/* Function: libc_total
+ * --------------------
+ * Bytes glibc holds in its main heap plus its mapped chunks.
+ */
+static size_t libc_total(void)
+{
+    struct mallinfo2 mi = mallinfo2();
+    return mi.arena + mi.hblkhd;
+}
+
+/* Function: libc_init
+ * -------------------
+ * glibc cannot be reset, so hand back what it can and measure the
+ * footprint of the pass relative to where it starts.
+ */
+static bool libc_init(void)
+{
+    malloc_trim(0);
+    libc_baseline = libc_total();
+    return true;
+}
+
+static size_t libc_footprint(void)
+{
+    size_t total = libc_total();
+    return total > libc_baseline ? total - libc_baseline : 0;
+}
+
+static const struct allocator allocators[] = {
+    {"mymalloc", myinit, mymalloc, myrealloc, myfree, myfootprint, validate_heap},
+    {"libc", libc_init, malloc, realloc, free, libc_footprint, NULL},
+};
+#define NALLOCATORS (int)(sizeof(allocators) / sizeof(allocators[0]))
+
+
+/**** **** ****         Trace Functions         **** **** ****/
+
+/* Function: map_array
+ * --------------------
+ * Zeroed memory for the harness's own tables, taken straight from the
+ * OS so that it never lands in a heap being measured.
+ */
+static void *map_array(size_t n, size_t elemsz)
+{
+    void *p = mmap(NULL, n * elemsz, PROT_READ | PROT_WRITE, 
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    return p;
+}
+
+/* Function: read_trace
+ * --------------------
+ * Parses the script at path into an array of requests. Exits with a
+ * message naming the line on any malformed request.
+ */
+static void read_trace(const char *path, struct trace *t)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(path);
+        exit(1);
+    }
+    const char *slash = strrchr(path, '/');
+    t->name = slash ? slash + 1 : path;
+    t->nops = t->nids = 0;
+    if (st.st_size == 0) {
+        close(fd);
+        return;
+    }
+
+    // One byte longer than the file, so the text ends in a NUL
+    char *text = map_array(st.st_size + 1, 1);
+    for (ssize_t got = 0, n; got < st.st_size; got += n) {
+        n = read(fd, text + got, st.st_size - got);
+        if (n <= 0) {
+            perror(path);
+            exit(1);
+        }
+    }
+    close(fd);
+
+    int nlines = 1;
+    for (char *c = text; *c; c++) nlines += *c == '\n';
+    t->ops = map_array(nlines, sizeof(struct op));
+
+    int lineno = 0;
+    for (char *s = text, *next; *s; s = next) {
+        next = strchr(s, '\n');
+        next = next ? next + 1 : s + strlen(s);
+        lineno++;
+        s += strspn(s, " \t");
+        if (*s == '#' || *s == '\n' || *s == '\0') continue;
+
+        // Parsed with strtol, since sscanf takes the length of the whole 
+        // remaining text on every call and large traces would take minutes
+        struct op op = {.type = *s};
+        char *end;
+        long id = strtol(s + 1, &end, 10);
+        bool ok = end > s + 1 && id >= 0 && id <= INT_MAX;
+        op.id = id;
+        if (op.type == 'a' || op.type == 'r') {
+            char *num = end;
+            op.size = strtoul(num, &end, 10);
+            ok = ok && end > num;
+        } else {
+            ok = ok && op.type == 'f';
+        }
+        if (!ok) {
+            fprintf(stderr, "%s:%d: bad request: %.*s", path, lineno,
+                    (int)(next - s), s);
+            exit(1);
+        }
+        t->ops[t->nops++] = op;
+        if (op.id >= t->nids) t->nids = op.id + 1;
+    }
+    munmap(text, st.st_size + 1);
+}
+
+
+/**** **** ****         Replay Functions        **** **** ****/
+
+/* Function: fill, check
+ * ---------------------
+ * Stamp a payload with a byte derived from its id, and verify that
+ * the first len bytes still carry the stamp.
+ */
+static void fill(void *p, int id, size_t len)
+{
+    memset(p, id & 0xff, len);
+}
+
+static bool check(const void *p, int id, size_t len)
+{
+    const unsigned char *c = p;
+    for (size_t i = 0; i < len; i++) {
+        if (c[i] != (unsigned char)(id & 0xff)) return false;
+    }
+    return true;
+}
+
+/* Function: release_all
+ * ---------------------
+ * Frees whatever the script left live so the next pass starts empty.
+ */
+static void release_all(const struct allocator *al, int nids)
+{
+    for (int i = 0; i < nids; i++) {
+        if (blocks[i] != NULL) al->free(blocks[i]);
+    }
+}
+
+// Hand-off to the thread that makes the frees of a remote pass
+static struct {
+    const struct allocator *al;
+    void *ptr;              // block to free
+    bool stop;
+    sem_t posted, done;
+} freer;
+
+/* Function: freer_main, remote_free
+ * ---------------------------------
+ * The freer thread frees each block posted to it with remote_free, 
+ * which waits until the free is done, so that a pass stays as 
+ * deterministic as the script. 
+ */
+static void *freer_main(void *arg)
+{
+    (void)arg;
+    for (;;) {
+        sem_wait(&freer.posted);
+        if (freer.stop) break;
+        freer.al->free(freer.ptr);
+        sem_post(&freer.done);
+    }
+    return NULL;
+}
+
+static void remote_free(void *p)
+{
+    freer.ptr = p;
+    sem_post(&freer.posted);
+    sem_wait(&freer.done);
+}
+
+/* Function: run_checked
+ * ---------------------
+ * Replays the script once, checking every payload survives intact and
+ * tracking the peak live payload against the peak footprint (and with 
+ * -v the whole heap after every request). If remote is set, frees go 
+ * through the freer thread. Returns the utilization, or a negative 
+ * value if a request failed.
+ */
+static double run_checked(const struct allocator *al, const struct trace *t,
+                          bool remote)
+{
+    memset(blocks, 0, t->nids * sizeof(void *));
+    memset(sizes, 0, t->nids * sizeof(size_t));
+    if (!al->init()) return -1;
+
+    size_t live = 0, peak_live = 0, peak_footprint = 0;
+    for (int i = 0; i < t->nops; i++) {
+        const struct op *op = &t->ops[i];
+        void *p = blocks[op->id];
+        size_t old = sizes[op->id];
+
+        if (p != NULL && !check(p, op->id, old)) {
+            fprintf(stderr, "%s: %s: request %d: payload of block %d "
+                    "was corrupted\n", al->name, t->name, i, op->id);
+            return -1;
+        }
+        if (op->type == 'a') {
+            p = al->malloc(op->size);
+            live += op->size;
+        } else if (op->type == 'r') {
+            p = al->realloc(p, op->size);
+            live += op->size - old;
+        } else {
+            if (remote) remote_free(p);
+            else al->free(p);
+            p = NULL;
+            live -= old;
+        }
+        if (op->type != 'f') {
+            if (p == NULL && op->size > 0) {
+                fprintf(stderr, "%s: %s: request %d failed\n",
+                        al->name, t->name, i);
+                return -1;
+            }
+            // A block must be aligned for any object that fits in it: 
+            // the largest power of two not above its size
+            size_t align = op->size == 0 ? 0 : 
+                           (size_t)1 << (8 * sizeof(size_t) - 1 - __builtin_clzl(op->size));
+            if (align > REPLAY_ALIGN) align = REPLAY_ALIGN;
+            if (align != 0 && (uintptr_t)p % align != 0) {
+                fprintf(stderr, "%s: %s: request %d returned misaligned "
+                        "%p\n", al->name, t->name, i, p);
+                return -1;
+            }
+            if (op->type == 'r' && !check(p, op->id, old < op->size ?
+                                          old : op->size)) {
+                fprintf(stderr, "%s: %s: request %d: realloc lost the "
+                        "payload of block %d\n", al->name, t->name, i,
+                        op->id);
+                return -1;
+            }
+            fill(p, op->id, op->size);
+        }
+        blocks[op->id] = p;
+        sizes[op->id] = op->type == 'f' ? 0 : op->size;
+
+        if (validate && al->validate != NULL && !al->validate()) {
+            fprintf(stderr, "%s: %s: request %d left the heap "
+                    "inconsistent\n", al->name, t->name, i);
+            return -1;
+        }
+        if (live > peak_live) peak_live = live;
+        size_t fp = al->footprint();
+        if (fp > peak_footprint) peak_footprint = fp;
+    }
+    release_all(al, t->nids);
+    return peak_footprint ? (double)peak_live / peak_footprint : 0;
+}
+
+/* Function: run_remote
+ * --------------------
+ * Runs a checked pass whose frees are made by a second thread, which 
+ * mymalloc attaches to another arena than the one the blocks come 
+ * from. Returns what run_checked does. 
+ */
+static double run_remote(const struct allocator *al, const struct trace *t)
+{
+    pthread_t thread;
+    freer.al = al;
+    freer.stop = false;
+    sem_init(&freer.posted, 0, 0);
+    sem_init(&freer.done, 0, 0);
+    if (pthread_create(&thread, NULL, freer_main, NULL) != 0) {
+        fprintf(stderr, "%s: %s: cannot start the freer thread\n",
+                al->name, t->name);
+        return -1;
+    }
+    double util = run_checked(al, t, true);
+    freer.stop = true;
+    sem_post(&freer.posted);
+    pthread_join(thread, NULL);
+    if (util >= 0 && validate && al->validate != NULL && !al->validate()) {
+        fprintf(stderr, "%s: %s: the freer thread's exit left the heap "
+                "inconsistent\n", al->name, t->name);
+        return -1;
+    }
+    return util;
+}
+
+#define EXIT_ROUNDS 64    // owner threads started by an exit race
+#define EXIT_BATCH 64     // blocks each owner allocates
+
+// Hand-off from an owner thread of an exit race to the main thread
+static struct {
+    const struct allocator *al;
+    const struct trace *t;
+    int next;               // next request whose size to allocate
+    void *ptrs[EXIT_BATCH];
+    sem_t ready;
+} owner;
+
+/* Function: owner_main
+ * --------------------
+ * An owner thread allocates EXIT_BATCH blocks sized as the script's 
+ * next allocations, hands them to the main thread and exits at once, 
+ * while the main thread frees them. 
+ */
+static void *owner_main(void *arg)
+{
+    (void)arg;
+    for (int i = 0; i < EXIT_BATCH; i++) {
+        const struct op *op;
+        do {
+            op = &owner.t->ops[owner.next];
+            owner.next = (owner.next + 1) % owner.t->nops;
+        } while (op->type == 'f');
+        owner.ptrs[i] = owner.al->malloc(op->size);
+    }
+    sem_post(&owner.ready);
+    return NULL;
+}
+
+/* Function: run_exit_race
+ * -----------------------
+ * Frees the blocks of each of EXIT_ROUNDS short-lived owner threads from
+ * the main thread, which mymalloc attaches to another arena, while the
+ * owner detaches from its own. Remote frees that race the owner's exit
+ * must not be left on the queue of an arena with no thread attached, 
+ * which the heap check after each round catches. Returns false if the
+ * heap was left inconsistent.
+ */
+static bool run_exit_race(const struct allocator *al, const struct trace *t)
+{
+    if (al->validate == NULL) return true;
+    if (!al->init()) return false;
+    al->free(al->malloc(1));        // attach before any owner does
+    owner.al = al;
+    owner.t = t;
+    owner.next = 0;
+    sem_init(&owner.ready, 0, 0);
+    for (int r = 0; r < EXIT_ROUNDS; r++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, owner_main, NULL) != 0) {
+            fprintf(stderr, "%s: %s: cannot start an owner thread\n",
+                    al->name, t->name);
+            return false;
+        }
+        sem_wait(&owner.ready);
+        for (int i = 0; i < EXIT_BATCH; i++) al->free(owner.ptrs[i]);
+        pthread_join(thread, NULL);
+        if (!al->validate()) {
+            fprintf(stderr, "%s: %s: round %d of the exit race left the "
+                    "heap inconsistent\n", al->name, t->name, r);
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Function: run_timed
+ * -------------------
+ * Replays the script once without checks. If per_op is set, records the
+ * ticks of each request in lat[]; either way returns the elapsed
+ * wall-clock seconds for the whole script.
+ */
+static double run_timed(const struct allocator *al, const struct trace *t,
+                        bool per_op)
+{
+    memset(blocks, 0, t->nids * sizeof(void *));
+    al->init();
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < t->nops; i++) {
+        const struct op *op = &t->ops[i];
+        uint64_t t0 = per_op ? ticks() : 0;
+        if (op->type == 'a') {
+            blocks[op->id] = al->malloc(op->size);
+        } else if (op->type == 'r') {
+            blocks[op->id] = al->realloc(blocks[op->id], op->size);
+        } else {
+            al->free(blocks[op->id]);
+            blocks[op->id] = NULL;
+        }
+        if (per_op) lat[i] = ticks() - t0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    release_all(al, t->nids);
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* Function: percentile
+ * --------------------
+ * The value below which the given fraction of the sorted samples lie.
+ */
+static uint64_t percentile(const uint64_t *sorted, int n, double frac)
+{
+    int i = (int)(frac * (n - 1) + 0.5);
+    return sorted[i];
+}
+
+/* Function: open_tlb_counter
+ * ---------------------------
+ * Opens a disabled counter of this process's data TLB load misses in 
+ * user space. Returns -1 if they cannot be counted, as in most virtual 
+ * machines or with kernel.perf_event_paranoid above 2. 
+ */
+static int open_tlb_counter(void)
+{
+    struct perf_event_attr pe;
+    memset(&pe, 0, sizeof(pe));
+    pe.size = sizeof(pe);
+    pe.type = PERF_TYPE_HW_CACHE;
+    pe.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    pe.disabled = 1;
+    pe.exclude_kernel = 1;
+    pe.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &pe, 0, -1, -1, 0);
+}
+
+static long minor_faults(void)
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_minflt;
+}
+
+/* Function: measure
+ * -----------------
+ * Runs one checked pass (and with -v one more with remote frees, then
+ * an exit race), one pass with per-request timestamps and reps untimed
+ * passes for throughput, counting TLB misses and page faults over the 
+ * latter if asked to. Returns false if a checked pass found the 
+ * allocator misbehaving.
+ */
+static bool measure(const struct allocator *al, const struct trace *t,
+                    int reps, struct result *r)
+{
+    r->util = run_checked(al, t, false);
+    if (r->util < 0) return false;
+    if (validate && run_remote(al, t) < 0) return false;
+    if (validate && !run_exit_race(al, t)) return false;
+
+    run_timed(al, t, true);
+    qsort(lat, t->nops, sizeof(uint64_t), cmp_u64);
+    r->p50 = percentile(lat, t->nops, 0.50);
+    r->p90 = percentile(lat, t->nops, 0.90);
+    r->p99 = percentile(lat, t->nops, 0.99);
+    r->p999 = percentile(lat, t->nops, 0.999);
+    r->max = lat[t->nops - 1];
+
+    int tlb = count_tlb ? open_tlb_counter() : -1;
+    long faults = minor_faults();
+    if (tlb >= 0) ioctl(tlb, PERF_EVENT_IOC_ENABLE, 0);
+    double secs = 0;
+    for (int i = 0; i < reps; i++) secs += run_timed(al, t, false);
+    r->ops_per_sec = secs > 0 ? (double)t->nops * reps / secs : 0;
+
+    uint64_t misses;
+    r->tlb_misses = -1;
+    if (tlb >= 0) {
+        ioctl(tlb, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(tlb, &misses, sizeof(misses)) == sizeof(misses)) {
+            r->tlb_misses = (double)misses / ((double)t->nops * reps);
+        }
+        close(tlb);
+    }
+    r->faults = (double)(minor_faults() - faults) / reps;
+    return true;
+}
+
+/* Function: measure_apart
+ * -----------------------
+ * Runs measure in a forked child and collects its result over a pipe,
+ * so that no pass inherits a heap shaped by an earlier one.
+ */
+static bool measure_apart(const struct allocator *al,
+                          const struct trace *t, int reps, struct result *r)
+{
+    int fds[2];
+    if (pipe(fds) < 0) {
+        perror("pipe");
+        exit(1);
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        bool ok = measure(al, t, reps, r);
+        if (ok && write(fds[1], r, sizeof(*r)) != sizeof(*r)) ok = false;
+        _exit(ok ? 0 : 1);
+    }
+    close(fds[1]);
+    ssize_t n = read(fds[0], r, sizeof(*r));
+    close(fds[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    return n == sizeof(*r) && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static void print_row(const char *trace, const char *alloc,
+                      const struct result *r)
+{
+    printf("%-22s %-9s %6.1f%% %10.1f %7" PRIu64 " %7" PRIu64 " %7"
+           PRIu64 " %7" PRIu64 " %9" PRIu64, trace, alloc,
+           100 * r->util, r->ops_per_sec / 1e3, r->p50, r->p90, r->p99,
+           r->p999, r->max);
+    if (count_tlb) {
+        if (r->tlb_misses >= 0) printf(" %9.3f", r->tlb_misses);
+        else printf(" %9s", "-");
+        printf(" %9.0f", r->faults);
+    }
+    printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int reps = DEFAULT_REPS, opt;
+    const char *only = NULL;
+    while ((opt = getopt(argc, argv, "n:a:tv")) != -1) {
+        if (opt == 'n' && atoi(optarg) > 0) {
+            reps = atoi(optarg);
+        } else if (opt == 'a') {
+            only = optarg;
+        } else if (opt == 't') {
+            count_tlb = true;
+        } else if (opt == 'v') {
+            validate = true;
+        } else {
+            fprintf(stderr, "usage: %s [-n reps] [-a allocator] [-t] [-v] script ...\n", argv[0]);
+            return 1;
+        }
+    }
+    int ntraces = argc - optind;
+    if (ntraces == 0) {
+        fprintf(stderr, "usage: %s [-n reps] [-a allocator] [-t] [-v] script ...\n", argv[0]);
+        return 1;
+    }
+
+    struct trace *traces = map_array(ntraces, sizeof(struct trace));
+    int maxops = 1, maxids = 1;
+    for (int i = 0; i < ntraces; i++) {
+        read_trace(argv[optind + i], &traces[i]);
+        if (traces[i].nops > maxops) maxops = traces[i].nops;
+        if (traces[i].nids > maxids) maxids = traces[i].nids;
+    }
+    blocks = map_array(maxids, sizeof(void *));
+    sizes = map_array(maxids, sizeof(size_t));
+    lat = map_array(maxops, sizeof(uint64_t));
+
+    printf("%-22s %-9s %7s %10s %7s %7s %7s %7s %9s", "trace",
+           "allocator", "util", "Kops/s", "p50", "p90", "p99", "p99.9",
+           "max");
+    if (count_tlb) printf(" %9s %9s", "dTLB/op", "faults");
+    printf("\n%-22s %-9s %7s %10s %39s\n", "", "", "", "",
+           "(" TICK_UNIT " per request)");
+
+    struct result sum[NALLOCATORS];
+    memset(sum, 0, sizeof(sum));
+    int status = 0;
+    for (int i = 0; i < ntraces; i++) {
+        for (int j = 0; j < NALLOCATORS; j++) {
+            struct result r;
+            if (traces[i].nops == 0) continue;
+            if (only != NULL && strcmp(only, allocators[j].name) != 0) continue;
+            if (!measure_apart(&allocators[j], &traces[i], reps, &r)) {
+                status = 1;
+                continue;
+            }
+            print_row(traces[i].name, allocators[j].name, &r);
+            sum[j].util += r.util / ntraces;
+            sum[j].ops_per_sec += r.ops_per_sec / ntraces;
+        }
+    }
+    for (int j = 0; j < NALLOCATORS; j++) {
+        if (only != NULL && strcmp(only, allocators[j].name) != 0) continue;
+        printf("%-22s %-9s %6.1f%% %10.1f\n", "average", allocators[j].name,
+               100 * sum[j].util, sum[j].ops_per_sec / 1e3);
+    }
+    return status;
+}
@@ -0,0 +1,107 @@
+/*
+ * File: segment.c
+ * ---------------
+ * Provides segments as reservations of address space mapped PROT_NONE,
+ * which neither touch nor count against memory, then committed with
+ * mprotect in SEGMENT_COMMIT chunks as they grow, so that a segment of
+ * many small extensions takes one call per chunk. Resetting a segment
+ * hands its pages back but keeps them committed. A segment advised to use
+ * huge pages commits whole huge pages instead. The heap segment is
+ * one such segment, kept here for clients of the single-segment calls.
+ */
+
+#include <stdint.h>
+#include <sys/mman.h>
+#include "segment.h"
+
+static struct segment heap_segment;
+
+
+bool reserve_segment(struct segment *seg, size_t len, size_t min_len, size_t align)
+{
+    size_t slack = align > PAGE_SIZE ? align : 0;
+    for (; len >= min_len && len > 0; len /= 2) {
+        // Over-reserve by the alignment, then trim to an aligned range
+        char *raw = mmap(NULL, len + slack, PROT_NONE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (raw == MAP_FAILED) continue;
+        char *base = (char *)(((uintptr_t)raw + align - 1) & ~(uintptr_t)(align - 1));
+        char *end = raw + len + slack;
+        if (base > raw) munmap(raw, base - raw);
+        if (end > base + len) munmap(base + len, end - (base + len));
+
+        seg->base = base;
+        seg->reserve = len;
+        seg->size = 0;
+        seg->committed = 0;
+        seg->huge = false;
+        return true;
+    }
+    return false;
+}
+
+bool advise_huge_segment(struct segment *seg)
+{
+    if (seg->base == NULL) return false;
+    seg->huge = true;
+    return madvise(seg->base, seg->reserve, MADV_HUGEPAGE) == 0;
+}
+
+void *grow_segment(struct segment *seg, size_t npages)
+{
+    if (seg->base == NULL) return NULL;
+    if (npages > (seg->reserve - seg->size) / PAGE_SIZE) return NULL;
+
+    size_t size = seg->size + npages * PAGE_SIZE;
+    if (size > seg->committed) {
+        size_t chunk = seg->huge ? HUGE_PAGE_SIZE : SEGMENT_COMMIT;
+        size_t committed = (size + chunk - 1) & ~(chunk - 1);
+        if (committed > seg->reserve) committed = seg->reserve;
+        if (mprotect(seg->base + seg->committed, committed - seg->committed,
+                     PROT_READ | PROT_WRITE) != 0) return NULL;
+        seg->committed = committed;
+    }
+
+    char *new_pages = seg->base + seg->size;
+    __atomic_store_n(&seg->size, size, __ATOMIC_RELEASE);
+    return new_pages;
+}
+
+void *reset_segment(struct segment *seg, size_t npages)
+{
+    if (seg->size > 0) madvise(seg->base, seg->size, MADV_DONTNEED);
+    __atomic_store_n(&seg->size, 0, __ATOMIC_RELEASE);
+    return grow_segment(seg, npages) == NULL ? NULL : seg->base;
+}
+
+void release_segment(struct segment *seg)
+{
+    if (seg->base != NULL) munmap(seg->base, seg->reserve);
+    seg->base = NULL;
+    seg->reserve = seg->size = seg->committed = 0;
+    seg->huge = false;
+}
+
+void *init_heap_segment(size_t npages)
+{
+    if (heap_segment.base == NULL &&
+        !reserve_segment(&heap_segment, SEGMENT_RESERVE, npages * PAGE_SIZE, PAGE_SIZE)) {
+        return NULL;
+    }
+    return reset_segment(&heap_segment, npages);
+}
+
+void *extend_heap_segment(size_t npages)
+{
+    return grow_segment(&heap_segment, npages);
+}
+
+void *heap_segment_start(void)
+{
+    return heap_segment.base;
+}
+
+size_t heap_segment_size(void)
+{
+    return heap_segment.size;
+}
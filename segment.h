@@ -0,0 +1,105 @@
+/* File: segment.h
+ * ---------------
+ * Interface to segments: reservations of address space that are handed
+ * out from their start, a page at a time, and only ever grow at their
+ * end. The allocator requests pages from here and carves them into
+ * blocks. A reservation costs no memory; pages are committed (made
+ * readable and writable) SEGMENT_COMMIT bytes at a time as the segment
+ * grows, so growing rarely calls into the kernel.
+ */
+#ifndef _SEGMENT_H
+#define _SEGMENT_H
+
+#include <stdbool.h> // for bool
+#include <stddef.h>  // for size_t
+
+#define PAGE_SIZE 4096
+#define HUGE_PAGE_SIZE ((size_t)1 << 21)
+
+// Address space set aside for the heap segment, halved until the kernel
+// agrees to it, and the granularity at which segments are committed
+#if defined(__LP64__)
+#define SEGMENT_RESERVE   ((size_t)1 << 36)
+#define SEGMENT_COMMIT    ((size_t)1 << 20)
+#else
+#define SEGMENT_RESERVE   ((size_t)1 << 30)
+#define SEGMENT_COMMIT    ((size_t)1 << 18)
+#endif
+
+struct segment {
+    char *base;         // start of the reservation (NULL if none)
+    size_t reserve;     // bytes of address space reserved
+    size_t size;        // bytes handed out so far, from base
+    size_t committed;   // bytes readable and writable so far, from base
+    bool huge;          // backed by transparent huge pages
+};
+
+
+/* Function: reserve_segment
+ * -------------------------
+ * Reserves len bytes of address space aligned to align (a power of two,
+ * at least PAGE_SIZE), halving len down to min_len while the kernel
+ * refuses. Nothing is handed out or committed yet. Returns false if not
+ * even min_len bytes could be reserved.
+ */
+bool reserve_segment(struct segment *seg, size_t len, size_t min_len, size_t align);
+
+/* Function: advise_huge_segment
+ * -----------------------------
+ * Asks the kernel to back a freshly reserved segment with transparent
+ * huge pages, and from then on commits it HUGE_PAGE_SIZE bytes at a time
+ * so that every committed huge page can be mapped whole. The segment
+ * should be aligned to HUGE_PAGE_SIZE. Returns false if the kernel does
+ * not support huge pages; the segment still works with small ones.
+ */
+bool advise_huge_segment(struct segment *seg);
+
+/* Function: grow_segment
+ * ----------------------
+ * Hands out npages more zeroed pages at the end of the segment,
+ * committing whole SEGMENT_COMMIT chunks as needed, and returns the
+ * address of the first new page, or NULL if the segment is full. The
+ * new size is published with release order, so other threads may read
+ * seg->size without a lock.
+ */
+void *grow_segment(struct segment *seg, size_t npages);
+
+/* Function: reset_segment
+ * -----------------------
+ * Discards everything handed out so far and starts over with npages
+ * zeroed pages, keeping what is committed. Returns the base address, or
+ * NULL if npages do not fit.
+ */
+void *reset_segment(struct segment *seg, size_t npages);
+
+/* Function: release_segment
+ * -------------------------
+ * Hands the whole reservation back to the OS.
+ */
+void release_segment(struct segment *seg);
+
+
+/* Function: init_heap_segment
+ * ---------------------------
+ * Sets up (or resets) the heap segment, a single segment of up to
+ * SEGMENT_RESERVE bytes, to hold npages zeroed pages and returns its
+ * base address, or NULL if the space cannot be reserved. Resetting
+ * discards everything previously in the segment.
+ */
+void *init_heap_segment(size_t npages);
+
+/* Function: extend_heap_segment
+ * -----------------------------
+ * Adds npages zeroed pages to the end of the heap segment and returns
+ * the address of the first new page, or NULL if the segment is full.
+ */
+void *extend_heap_segment(size_t npages);
+
+/* Function: heap_segment_start, heap_segment_size
+ * -----------------------------------------------
+ * Base address and current length in bytes of the heap segment.
+ */
+void *heap_segment_start(void);
+size_t heap_segment_size(void);
+
+#endif
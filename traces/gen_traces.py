@@ -0,0 +1,190 @@
+#!/usr/bin/env python3
+#
+# File: gen_traces.py
+# -------------------
+# Regenerates the bundled replay traces. Each trace is a script of
+#     a <id> <size>     allocate size bytes as block id
+#     r <id> <size>     reallocate block id to size bytes
+#     f <id>            free block id
+# with '#' comments. Seeds are fixed so the output is reproducible.
+#
+#     python3 gen_traces.py [name ...]
+#
+# With no names, writes the bundled traces. Large traces are only written
+# when named, e.g. `python3 gen_traces.py large-heap`, which `make hugebench`
+# does on first use. They go in large/, out of the repository and out of
+# `make bench`, being tens of megabytes each.
+#
+import os
+import random
+import sys
+
+
+class Trace:
+    def __init__(self, name, desc):
+        self.name, self.desc, self.ops = name, desc, []
+        self.next_id, self.live = 0, {}
+
+    def alloc(self, size):
+        i = self.next_id
+        self.next_id += 1
+        self.live[i] = size
+        self.ops.append("a %d %d" % (i, size))
+        return i
+
+    def realloc(self, i, size):
+        self.live[i] = size
+        self.ops.append("r %d %d" % (i, size))
+
+    def free(self, i):
+        del self.live[i]
+        self.ops.append("f %d" % i)
+
+    def free_all(self):
+        for i in list(self.live):
+            self.free(i)
+
+    def write(self, dirname="."):
+        os.makedirs(dirname, exist_ok=True)
+        with open(os.path.join(dirname, self.name + ".script"), "w") as f:
+            f.write("# %s\n# %d ops, %d ids\n" % (self.desc, len(self.ops), self.next_id))
+            f.write("\n".join(self.ops) + "\n")
+
+
+def tiny_churn(rng):
+    t = Trace("tiny-churn", "Waves of 1-16 byte blocks, all freed, then slightly larger waves")
+    for wave in range(6):
+        ids = [t.alloc(rng.randint(1, 4) + 2 * wave) for _ in range(2000)]
+        for i in ids:
+            t.free(i)
+    return t
+
+
+def reassemble(rng):
+    t = Trace("reassemble", "Small fragments freed in runs while slightly larger pieces are allocated")
+    pieces = [t.alloc(rng.randint(16, 64)) for _ in range(600)]
+    for step in range(3000):
+        if pieces and rng.random() < 0.6:
+            t.free(pieces.pop(rng.randrange(len(pieces))))
+        pieces.append(t.alloc(rng.randint(16, 64) + step // 40))
+    t.free_all()
+    return t
+
+
+def realloc_growth(rng):
+    t = Trace("realloc-growth", "Vectors grown by doubling and by small steps, interleaved with allocations")
+    vecs = {t.alloc(16): 16 for _ in range(40)}
+    for step in range(4000):
+        i = rng.choice(list(vecs))
+        grow = vecs[i] * 2 if rng.random() < 0.1 else vecs[i] + rng.randint(8, 64)
+        if grow > 1 << 20:
+            t.free(i)
+            del vecs[i]
+            vecs[t.alloc(16)] = 16
+            continue
+        vecs[i] = grow
+        t.realloc(i, grow)
+        if rng.random() < 0.3:
+            t.free(t.alloc(rng.randint(8, 256)))
+    t.free_all()
+    return t
+
+
+def coalesce(rng):
+    t = Trace("coalesce", "Rows of equal blocks, every other freed, then refilled with merged sizes")
+    for rnd in range(8):
+        size = rng.choice([24, 48, 100, 250, 1000])
+        row = [t.alloc(size) for _ in range(400)]
+        for i in row[::2]:
+            t.free(i)
+        for i in row[1::2]:
+            t.free(i)
+        big = [t.alloc(3 * size) for _ in range(150)]
+        for i in big:
+            t.free(i)
+    return t
+
+
+def random_mixed(rng):
+    t = Trace("random-mixed", "Random mix of malloc, free and realloc over a skewed size distribution")
+    ids = []
+    for step in range(20000):
+        r = rng.random()
+        if r < 0.45 or not ids:
+            size = int(rng.paretovariate(1.2) * 16)
+            ids.append(t.alloc(min(size, 200000)))
+        elif r < 0.85:
+            t.free(ids.pop(rng.randrange(len(ids))))
+        else:
+            i = rng.choice(ids)
+            t.realloc(i, min(int(rng.paretovariate(1.2) * 16), 200000))
+    t.free_all()
+    return t
+
+
+def large_blocks(rng):
+    t = Trace("large-blocks", "Multi-megabyte buffers allocated, grown with realloc and freed")
+    ids = []
+    for step in range(400):
+        if len(ids) < 8 or rng.random() < 0.4:
+            ids.append(t.alloc(rng.randint(1 << 16, 1 << 22)))
+        elif rng.random() < 0.5:
+            i = rng.choice(ids)
+            t.realloc(i, min(t.live[i] * 2, 1 << 24))
+        else:
+            t.free(ids.pop(rng.randrange(len(ids))))
+    t.free_all()
+    return t
+
+
+def binned(rng):
+    t = Trace("binned", "Long-lived 64-byte nodes interleaved with short-lived 448-byte buffers")
+    keep = []
+    for step in range(6000):
+        keep.append(t.alloc(64))
+        tmp = t.alloc(448)
+        t.free(tmp)
+        if len(keep) > 3000 and rng.random() < 0.5:
+            t.free(keep.pop(rng.randrange(len(keep))))
+    t.free_all()
+    return t
+
+
+def large_heap(rng):
+    t = Trace("large-heap", "A heap of about 180 MB of small and medium blocks, churned at random addresses")
+    ids = []
+    def size():
+        return rng.randint(1 << 10, 1 << 13) if rng.random() < 0.02 else min(int(rng.paretovariate(1.5) * 48), 4096)
+    for _ in range(800000):
+        ids.append(t.alloc(size()))
+    for _ in range(250000):
+        t.free(ids.pop(rng.randrange(len(ids))))
+    for step in range(600000):
+        j = rng.randrange(len(ids))
+        t.free(ids[j])
+        ids[j] = t.alloc(size())
+    t.free_all()
+    return t
+
+
+def large_free(rng):
+    t = Trace("large-free", "Thousands of 1-64 KB blocks replaced at random, leaving many large holes")
+    ids = [t.alloc(rng.randint(1 << 10, 1 << 16)) for _ in range(3000)]
+    for step in range(12000):
+        t.free(ids.pop(rng.randrange(len(ids))))
+        ids.append(t.alloc(rng.randint(1 << 10, 1 << 16)))
+    t.free_all()
+    return t
+
+
+BUNDLED = [tiny_churn, reassemble, realloc_growth, coalesce,
+           random_mixed, large_blocks, binned, large_free]
+LARGE = [large_heap]
+
+if __name__ == "__main__":
+    os.chdir(os.path.dirname(os.path.abspath(__file__)))
+    names = sys.argv[1:]
+    for i, gen in enumerate(BUNDLED + LARGE):
+        name = gen.__name__.replace("_", "-")
+        if (names and name in names) or (not names and gen in BUNDLED):
+            gen(random.Random(107 + i)).write("large" if gen in LARGE else ".")